@@ -623,6 +623,28 @@ extern "C" {
 	 */
 	void bam_index_destroy(bam_index_t *idx);
 
+	/*!
+	  @abstract   Concatenate BAM files by copying their compressed blocks.
+	  @discussion Only the header is recompressed, so the files must hold
+	  disjoint ranges and be given in the order of the output.
+	  @param  nfn     number of input files
+	  @param  fn      names of the input files
+	  @param  h       header of the output; the header of fn[0] if NULL
+	  @param  outbam  name of the output file; "-" for stdout
+	  @return     0 on success; non-zero on failure
+	 */
+	int bam_cat(int nfn, char * const *fn, const bam_header_t *h, const char* outbam);
+
+	/*!
+	  @abstract    Retrieve the number of records of a reference from the index.
+	  @param  idx       pointer to the index structure
+	  @param  tid       chromosome ID as is defined in the header
+	  @param  mapped    the returned number of mapped records
+	  @param  unmapped  the returned number of unmapped records placed on tid
+	  @return     0 on success; -1 if the index holds no statistics for tid
+	 */
+	int bam_index_stat(const bam_index_t *idx, int tid, uint64_t *mapped, uint64_t *unmapped);
+
 	/*! @typedef
 	  @abstract      Type of function to be called by bam_fetch().
 	  @param  b     the alignment
@@ -564,6 +564,20 @@ int bam_idxstats(int argc, char *argv[])
 	return 0;
 }
 
+int bam_index_stat(const bam_index_t *idx, int tid, uint64_t *mapped, uint64_t *unmapped)
+{
+	khint_t k;
+	khash_t(i) *h;
+	*mapped = *unmapped = 0;
+	if (tid < 0 || tid >= idx->n) return -1;
+	h = idx->index[tid];
+	k = kh_get(i, h, BAM_MAX_BIN);
+	if (k == kh_end(h)) return -1;
+	*mapped = kh_val(h, k).list[1].u;
+	*unmapped = kh_val(h, k).list[1].v;
+	return 0;
+}
+
 static inline int reg2bins(uint32_t beg, uint32_t end, uint16_t list[BAM_MAX_BIN])
 {
 	int i = 0, k;
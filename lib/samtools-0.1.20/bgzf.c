@@ -72,6 +72,10 @@ typedef FILE *_bgzf_file_t;
 */
 static const uint8_t g_magic[19] = "\037\213\010\4\0\0\0\0\0\377\6\0\102\103\2\0\0\0";
 
+static int64_t next_block_address(BGZF *fp);
+static int ra_read_block(BGZF *fp);
+static int ra_reset(BGZF *fp, int64_t block_address);
+
 #ifdef BGZF_CACHE
 typedef struct {
 	int size;
@@ -210,33 +214,34 @@ static int deflate_block(BGZF *fp, int block_length)
 	return comp_size;
 }
 
-// Inflate the block in fp->compressed_block into fp->uncompressed_block
-static int inflate_block(BGZF* fp, int block_length)
+// Inflate a BGZF block of block_length bytes in src into dst; return the uncompressed size or -1 on error
+static int bgzf_uncompress(void *dst, void *src, int block_length)
 {
 	z_stream zs;
 	zs.zalloc = NULL;
 	zs.zfree = NULL;
-	zs.next_in = fp->compressed_block + 18;
+	zs.next_in = (uint8_t*)src + 18;
 	zs.avail_in = block_length - 16;
-	zs.next_out = fp->uncompressed_block;
+	zs.next_out = dst;
 	zs.avail_out = BGZF_MAX_BLOCK_SIZE;
 
-	if (inflateInit2(&zs, -15) != Z_OK) {
-		fp->errcode |= BGZF_ERR_ZLIB;
-		return -1;
-	}
+	if (inflateInit2(&zs, -15) != Z_OK) return -1;
 	if (inflate(&zs, Z_FINISH) != Z_STREAM_END) {
 		inflateEnd(&zs);
-		fp->errcode |= BGZF_ERR_ZLIB;
-		return -1;
-	}
-	if (inflateEnd(&zs) != Z_OK) {
-		fp->errcode |= BGZF_ERR_ZLIB;
 		return -1;
 	}
+	if (inflateEnd(&zs) != Z_OK) return -1;
 	return zs.total_out;
 }
 
+// Inflate the block in fp->compressed_block into fp->uncompressed_block
+static int inflate_block(BGZF* fp, int block_length)
+{
+	int ret = bgzf_uncompress(fp->uncompressed_block, fp->compressed_block, block_length);
+	if (ret < 0) fp->errcode |= BGZF_ERR_ZLIB;
+	return ret;
+}
+
 static int check_header(const uint8_t *header)
 {
 	return (header[0] == 31 && header[1] == 139 && header[2] == 8 && (header[3] & 4) != 0
@@ -267,8 +272,9 @@ static int load_block_from_cache(BGZF *fp, int64_t block_address)
 	if (fp->block_length != 0) fp->block_offset = 0;
 	fp->block_address = block_address;
 	fp->block_length = p->size;
-	memcpy(fp->uncompressed_block, p->block, BGZF_MAX_BLOCK_SIZE);
-	_bgzf_seek((_bgzf_file_t)fp->fp, p->end_offset, SEEK_SET);
+	memcpy(fp->uncompressed_block, p->block, p->size);
+	if (fp->mt) ra_reset(fp, p->end_offset);
+	else _bgzf_seek((_bgzf_file_t)fp->fp, p->end_offset, SEEK_SET);
 	return p->size;
 }
 
@@ -279,26 +285,31 @@ static void cache_block(BGZF *fp, int size)
 	cache_t *p;
 	khash_t(cache) *h = (khash_t(cache)*)fp->cache;
 	if (BGZF_MAX_BLOCK_SIZE >= fp->cache_size) return;
-	if ((kh_size(h) + 1) * BGZF_MAX_BLOCK_SIZE > fp->cache_size) {
-		/* A better way would be to remove the oldest block in the
-		 * cache, but here we remove a random one for simplicity. This
-		 * should not have a big impact on performance. */
-		for (k = kh_begin(h); k < kh_end(h); ++k)
-			if (kh_exist(h, k)) break;
-		if (k < kh_end(h)) {
-			free(kh_val(h, k).block);
-			kh_del(cache, h, k);
-		}
-	}
+	/* A full cache admits no more blocks. Evicting blocks of a scan larger
+	 * than the cache would leave none for a second scan of the same range,
+	 * which then finds its first blocks here; bgzf_clear_cache() empties it
+	 * for another range. */
+	if ((kh_size(h) + 1) * BGZF_MAX_BLOCK_SIZE > fp->cache_size) return;
 	k = kh_put(cache, h, fp->block_address, &ret);
 	if (ret == 0) return; // if this happens, a bug!
 	p = &kh_val(h, k);
 	p->size = fp->block_length;
 	p->end_offset = fp->block_address + size;
-	p->block = malloc(BGZF_MAX_BLOCK_SIZE);
-	memcpy(kh_val(h, k).block, fp->uncompressed_block, BGZF_MAX_BLOCK_SIZE);
+	p->block = malloc(fp->block_length);
+	memcpy(kh_val(h, k).block, fp->uncompressed_block, fp->block_length);
+}
+
+void bgzf_clear_cache(BGZF *fp)
+{
+	khint_t k;
+	khash_t(cache) *h = (khash_t(cache)*)fp->cache;
+	if (fp->is_write) return;
+	for (k = kh_begin(h); k < kh_end(h); ++k)
+		if (kh_exist(h, k)) free(kh_val(h, k).block);
+	kh_clear(cache, h);
 }
 #else
+void bgzf_clear_cache(BGZF *fp) {}
 static void free_cache(BGZF *fp) {}
 static int load_block_from_cache(BGZF *fp, int64_t block_address) {return 0;}
 static void cache_block(BGZF *fp, int size) {}
@@ -309,6 +320,7 @@ int bgzf_read_block(BGZF *fp)
 	uint8_t header[BLOCK_HEADER_LENGTH], *compressed_block;
 	int count, size = 0, block_length, remaining;
 	int64_t block_address;
+	if (fp->mt) return ra_read_block(fp);
 	block_address = _bgzf_tell((_bgzf_file_t)fp->fp);
 	if (fp->cache_size && load_block_from_cache(fp, block_address)) return 0;
 	count = _bgzf_read(fp->fp, header, sizeof(header));
@@ -361,7 +373,7 @@ ssize_t bgzf_read(BGZF *fp, void *data, size_t length)
 		bytes_read += copy_length;
 	}
 	if (fp->block_offset == fp->block_length) {
-		fp->block_address = _bgzf_tell((_bgzf_file_t)fp->fp);
+		fp->block_address = next_block_address(fp);
 		fp->block_offset = fp->block_length = 0;
 	}
 	return bytes_read;
@@ -523,6 +535,209 @@ static ssize_t mt_write(BGZF *fp, const void *data, size_t length)
 
 /***** END: multi-threading *****/
 
+/***** BEGIN: multi-threaded read-ahead *****/
+
+/* The reading thread reads the next compressed blocks into a ring, and the
+ * workers inflate them in parallel. Blocks are handed back in file order, so
+ * the virtual offsets are those of serial reading. The file position is ahead
+ * of the reader; next_block_address() returns the logical position. */
+
+#define RA_EMPTY  0
+#define RA_QUEUED 1
+#define RA_BUSY   2
+#define RA_DONE   3
+
+typedef struct {
+	int64_t address; // file offset of the block
+	int size, length; // compressed and uncompressed sizes; length<0 on error
+	int state, errcode;
+	void *cblk, *ublk;
+} rablk_t;
+
+typedef struct {
+	int n_threads, n_blks, head, n, done, eof; // blk[head] is the next of the n blocks read ahead
+	int64_t next, ahead; // end of the last returned block; end of the last block read ahead
+	rablk_t *blk;
+	pthread_t *tid;
+	pthread_mutex_t lock;
+	pthread_cond_t cv_work, cv_done;
+} raaux_t;
+
+static void *ra_worker(void *data)
+{
+	raaux_t *ra = (raaux_t*)data;
+	pthread_mutex_lock(&ra->lock);
+	for (;;) {
+		int i;
+		rablk_t *p = 0;
+		for (i = 0; i < ra->n; ++i) { // the earliest queued block first
+			rablk_t *q = &ra->blk[(ra->head + i) % ra->n_blks];
+			if (q->state == RA_QUEUED) { p = q; break; }
+		}
+		if (p == 0) {
+			if (ra->done) break;
+			pthread_cond_wait(&ra->cv_work, &ra->lock);
+			continue;
+		}
+		p->state = RA_BUSY;
+		pthread_mutex_unlock(&ra->lock);
+		p->length = bgzf_uncompress(p->ublk, p->cblk, p->size);
+		if (p->length < 0) p->errcode = BGZF_ERR_ZLIB;
+		pthread_mutex_lock(&ra->lock);
+		p->state = RA_DONE;
+		pthread_cond_broadcast(&ra->cv_done);
+	}
+	pthread_mutex_unlock(&ra->lock);
+	return 0;
+}
+
+// Read compressed blocks until the ring is full or the end of file
+static void ra_fill(BGZF *fp)
+{
+	raaux_t *ra = (raaux_t*)fp->mt;
+	while (!ra->eof && ra->n < ra->n_blks) {
+		rablk_t *p = &ra->blk[(ra->head + ra->n) % ra->n_blks]; // empty; owned by the reading thread
+		uint8_t *cblk = (uint8_t*)p->cblk;
+		int count, remaining;
+		count = _bgzf_read(fp->fp, cblk, BLOCK_HEADER_LENGTH);
+		if (count == 0) { // no data read
+			ra->eof = 1;
+			break;
+		}
+		p->address = ra->ahead;
+		p->errcode = 0;
+		if (count != BLOCK_HEADER_LENGTH || !check_header(cblk)) {
+			p->errcode = BGZF_ERR_HEADER;
+		} else {
+			p->size = unpackInt16(&cblk[16]) + 1;
+			remaining = p->size - BLOCK_HEADER_LENGTH;
+			count = _bgzf_read(fp->fp, &cblk[BLOCK_HEADER_LENGTH], remaining);
+			if (count != remaining) p->errcode = BGZF_ERR_IO;
+		}
+		pthread_mutex_lock(&ra->lock);
+		if (p->errcode) { // reported when the block is returned
+			p->length = -1;
+			p->state = RA_DONE;
+			ra->eof = 1;
+		} else {
+			p->state = RA_QUEUED;
+			ra->ahead += p->size;
+			pthread_cond_signal(&ra->cv_work);
+		}
+		++ra->n;
+		pthread_mutex_unlock(&ra->lock);
+	}
+}
+
+static int ra_read_block(BGZF *fp)
+{
+	raaux_t *ra = (raaux_t*)fp->mt;
+	rablk_t *p;
+	void *tmp;
+	if (fp->cache_size && load_block_from_cache(fp, ra->next)) return 0;
+	ra_fill(fp);
+	if (ra->n == 0) { // end of file
+		fp->block_length = 0;
+		return 0;
+	}
+	p = &ra->blk[ra->head];
+	pthread_mutex_lock(&ra->lock);
+	while (p->state != RA_DONE) pthread_cond_wait(&ra->cv_done, &ra->lock);
+	if (p->length < 0) {
+		pthread_mutex_unlock(&ra->lock);
+		fp->errcode |= p->errcode;
+		return -1;
+	}
+	tmp = fp->uncompressed_block; fp->uncompressed_block = p->ublk; p->ublk = tmp;
+	if (fp->block_length != 0) fp->block_offset = 0; // Do not reset offset if this read follows a seek.
+	fp->block_address = p->address;
+	fp->block_length = p->length;
+	ra->next = p->address + p->size;
+	p->state = RA_EMPTY;
+	ra->head = (ra->head + 1) % ra->n_blks;
+	--ra->n;
+	pthread_mutex_unlock(&ra->lock);
+	cache_block(fp, p->size);
+	ra_fill(fp);
+	return 0;
+}
+
+/* Position the reader at block_address. Blocks read ahead before it are
+ * dropped; if it is not read ahead, the ring is emptied and the file seeks. */
+static int ra_reset(BGZF *fp, int64_t block_address)
+{
+	raaux_t *ra = (raaux_t*)fp->mt;
+	int i, k;
+	for (k = 0; k < ra->n; ++k)
+		if (ra->blk[(ra->head + k) % ra->n_blks].address == block_address) break;
+	pthread_mutex_lock(&ra->lock);
+	for (i = 0; i < k; ++i) {
+		rablk_t *p = &ra->blk[(ra->head + i) % ra->n_blks];
+		while (p->state == RA_BUSY) pthread_cond_wait(&ra->cv_done, &ra->lock);
+		p->state = RA_EMPTY;
+	}
+	ra->head = (ra->head + k) % ra->n_blks;
+	ra->n -= k;
+	pthread_mutex_unlock(&ra->lock);
+	ra->next = block_address;
+	if (ra->n > 0 || (ra->ahead == block_address && !ra->eof)) return 0;
+	ra->eof = 0;
+	ra->head = 0;
+	ra->ahead = block_address;
+	return _bgzf_seek((_bgzf_file_t)fp->fp, block_address, SEEK_SET) < 0? -1 : 0;
+}
+
+static int64_t next_block_address(BGZF *fp)
+{
+	if (fp->mt) return ((raaux_t*)fp->mt)->next;
+	return _bgzf_tell((_bgzf_file_t)fp->fp);
+}
+
+int bgzf_mt_read(BGZF *fp, int n_threads, int n_sub_blks)
+{
+	int i;
+	raaux_t *ra;
+	if (fp->is_write || fp->mt || n_threads <= 0 || n_sub_blks <= 0) return -1;
+	ra = calloc(1, sizeof(raaux_t));
+	ra->n_threads = n_threads;
+	ra->n_blks = n_threads * n_sub_blks;
+	ra->blk = calloc(ra->n_blks, sizeof(rablk_t));
+	for (i = 0; i < ra->n_blks; ++i) {
+		ra->blk[i].cblk = malloc(BGZF_MAX_BLOCK_SIZE);
+		ra->blk[i].ublk = malloc(BGZF_MAX_BLOCK_SIZE);
+	}
+	ra->next = ra->ahead = _bgzf_tell((_bgzf_file_t)fp->fp);
+	pthread_mutex_init(&ra->lock, 0);
+	pthread_cond_init(&ra->cv_work, 0);
+	pthread_cond_init(&ra->cv_done, 0);
+	ra->tid = calloc(ra->n_threads, sizeof(pthread_t));
+	for (i = 0; i < ra->n_threads; ++i)
+		pthread_create(&ra->tid[i], 0, ra_worker, ra);
+	fp->mt = ra;
+	return 0;
+}
+
+static void ra_destroy(raaux_t *ra)
+{
+	int i;
+	pthread_mutex_lock(&ra->lock);
+	ra->done = 1;
+	pthread_cond_broadcast(&ra->cv_work);
+	pthread_mutex_unlock(&ra->lock);
+	for (i = 0; i < ra->n_threads; ++i) pthread_join(ra->tid[i], 0);
+	for (i = 0; i < ra->n_blks; ++i) {
+		free(ra->blk[i].cblk);
+		free(ra->blk[i].ublk);
+	}
+	free(ra->blk); free(ra->tid);
+	pthread_cond_destroy(&ra->cv_work);
+	pthread_cond_destroy(&ra->cv_done);
+	pthread_mutex_destroy(&ra->lock);
+	free(ra);
+}
+
+/***** END: multi-threaded read-ahead *****/
+
 int bgzf_flush(BGZF *fp)
 {
 	if (!fp->is_write) return 0;
@@ -581,7 +796,7 @@ int bgzf_close(BGZF* fp)
 			return -1;
 		}
 		if (fp->mt) mt_destroy(fp->mt);
-	}
+	} else if (fp->mt) ra_destroy(fp->mt);
 	ret = fp->is_write? fclose(fp->fp) : _bgzf_close(fp->fp);
 	if (ret != 0) return -1;
 	free(fp->uncompressed_block);
@@ -602,7 +817,7 @@ int bgzf_check_EOF(BGZF *fp)
 	uint8_t buf[28];
 	off_t offset;
 	offset = _bgzf_tell((_bgzf_file_t)fp->fp);
-	if (_bgzf_seek(fp->fp, -28, SEEK_END) < 0) return 0;
+	if (_bgzf_seek(fp->fp, -28, SEEK_END) < 0) return -1; // e.g. a pipe
 	_bgzf_read(fp->fp, buf, 28);
 	_bgzf_seek(fp->fp, offset, SEEK_SET);
 	return (memcmp(magic, buf, 28) == 0)? 1 : 0;
@@ -619,7 +834,12 @@ int64_t bgzf_seek(BGZF* fp, int64_t pos, int where)
 	}
 	block_offset = pos & 0xFFFF;
 	block_address = pos >> 16;
-	if (_bgzf_seek(fp->fp, block_address, SEEK_SET) < 0) {
+	if (fp->mt) {
+		if (ra_reset(fp, block_address) < 0) {
+			fp->errcode |= BGZF_ERR_IO;
+			return -1;
+		}
+	} else if (_bgzf_seek(fp->fp, block_address, SEEK_SET) < 0) {
 		fp->errcode |= BGZF_ERR_IO;
 		return -1;
 	}
@@ -650,7 +870,7 @@ int bgzf_getc(BGZF *fp)
 	}
 	c = ((unsigned char*)fp->uncompressed_block)[fp->block_offset++];
     if (fp->block_offset == fp->block_length) {
-        fp->block_address = _bgzf_tell((_bgzf_file_t)fp->fp);
+        fp->block_address = next_block_address(fp);
         fp->block_offset = 0;
         fp->block_length = 0;
     }
@@ -664,13 +884,14 @@ int bgzf_getc(BGZF *fp)
 int bgzf_getline(BGZF *fp, int delim, kstring_t *str)
 {
 	int l, state = 0;
-	unsigned char *buf = (unsigned char*)fp->uncompressed_block;
+	unsigned char *buf;
 	str->l = 0;
 	do {
 		if (fp->block_offset >= fp->block_length) {
 			if (bgzf_read_block(fp) != 0) { state = -2; break; }
 			if (fp->block_length == 0) { state = -1; break; }
 		}
+		buf = (unsigned char*)fp->uncompressed_block; // swapped by the read-ahead
 		for (l = fp->block_offset; l < fp->block_length && buf[l] != delim; ++l);
 		if (l < fp->block_length) state = 1;
 		l -= fp->block_offset;
@@ -683,7 +904,7 @@ int bgzf_getline(BGZF *fp, int delim, kstring_t *str)
 		str->l += l;
 		fp->block_offset += l + 1;
 		if (fp->block_offset >= fp->block_length) {
-			fp->block_address = _bgzf_tell((_bgzf_file_t)fp->fp);
+			fp->block_address = next_block_address(fp);
 			fp->block_offset = 0;
 			fp->block_length = 0;
 		} 
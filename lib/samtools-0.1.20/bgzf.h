@@ -140,7 +140,7 @@ extern "C" {
 	 * Check if the BGZF end-of-file (EOF) marker is present
 	 *
 	 * @param fp    BGZF file handler opened for reading
-	 * @return      1 if EOF is present; 0 if not or on I/O error
+	 * @return      1 if EOF is present; 0 if not or on I/O error; -1 if the file can not seek
 	 */
 	int bgzf_check_EOF(BGZF *fp);
 
@@ -164,6 +164,13 @@ extern "C" {
 	 */
 	void bgzf_set_cache_size(BGZF *fp, int size);
 
+	/**
+	 * Drop the cached blocks. A full cache admits no more blocks until cleared.
+	 *
+	 * @param fp    BGZF file handler
+	 */
+	void bgzf_clear_cache(BGZF *fp);
+
 	/**
 	 * Flush the file if the remaining buffer size is smaller than _size_ 
 	 */
@@ -200,6 +207,16 @@ extern "C" {
 	 */
 	int bgzf_mt(BGZF *fp, int n_threads, int n_sub_blks);
 
+	/**
+	 * Enable multi-threaded read-ahead: the next blocks are read and inflated
+	 * in parallel, and returned in file order. Seeking is supported.
+	 *
+	 * @param fp          BGZF file handler; must be opened for reading
+	 * @param n_threads   #threads inflating blocks
+	 * @param n_sub_blks  #blocks read ahead for each thread
+	 */
+	int bgzf_mt_read(BGZF *fp, int n_threads, int n_sub_blks);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,51 @@
+#ifndef BAMJOB_H
+#define BAMJOB_H
+
+#include <stdint.h>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <future>
+#include "tagcode.h"
+#include "chrjob.h"
+#include "crosstable.h"
+#include "sidecar.h"
+#include "checkpoint.h"
+
+using namespace std;
+
+// Input, decisions and outputs of an indexed BAM file. The chromosomes of the
+// files of a batch share the workers and the memory budget; every chromosome
+// points to its file, and the state of a file is only shared by its own
+// chromosomes.
+class BamJob {
+	public:
+		BamInput input;
+		string outfile;
+		string tmpprefix; // of the temporary files of the file
+		vector< unique_ptr< ChrJob > > jobs;
+		CrossTable crosstable; // fragments with ends on different chromosomes, resolved across workers
+		uint8_t validpairs[256]; // decision of every tag pair byte
+		bool pico; // protocol of the positive rate
+		shared_future< void > validready; // once validpairs is compiled, if estimated while the first scans run
+		Sidecar sidecar; // pair classes of the input; when valid, filtering only takes the second scans
+		bool keepclasses; // record the class of every record for a new sidecar
+		Checkpoint checkpoint; // chromosomes written, or restored from an interrupted run
+		vector< string > tmpfiles; // window files, in merge order
+		vector< string > classfiles;
+		TagCounts tagstats{}; // tagpair->number
+		atomic< bool > failed;
+	public:
+		BamJob():
+			pico(false)
+			, keepclasses(false)
+			, failed(false) {
+			memset(validpairs, 0, sizeof(validpairs));
+		}
+		BamJob(const BamJob &)=delete;
+		BamJob &operator=(const BamJob &)=delete;
+};
+
+#endif
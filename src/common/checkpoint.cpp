@@ -0,0 +1,162 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <map>
+#include <algorithm>
+#include <sys/stat.h>
+#include "checkpoint.h"
+#include "bgzf.h"
+
+static bool filesize(const string &file, int64_t &size) {
+	struct stat st;
+	if (stat(file.c_str(), &st)!=0) {
+		return false;
+	}
+	size=st.st_size;
+	return true;
+}
+
+// A whole BGZF file ends with the EOF block
+static bool bgzfcomplete(const string &file) {
+	BGZF *fp=bgzf_open(file.c_str(), "r");
+	if (fp==0) {
+		return false;
+	}
+	bool ok=bgzf_check_EOF(fp)==1;
+	bgzf_close(fp);
+	return ok;
+}
+
+// Restore a chromosome from its line in the manifest:
+// chr windows size... crosstags tagstats...
+bool Checkpoint::restore(ChrJob &job, const string &line) {
+	istringstream in(line);
+	string chr;
+	size_t n=0;
+	in >> chr >> n;
+	if (! in || n!=job.windows.size()) return false;
+	for (unique_ptr< Window > &window : job.windows) {
+		int64_t size=-1, actual;
+		in >> size;
+		if (! in || ! filesize(window->outfile, actual) || actual!=size || ! bgzfcomplete(window->outfile)) return false;
+	}
+	size_t ncross=0;
+	in >> ncross;
+	TagCounts tagstats{};
+	for (int pair=0; pair<NUMTAGPAIRS; pair++) {
+		in >> tagstats[pair];
+	}
+	if (! in) return false;
+
+	// the records are followed by their read names in verify mode
+	vector< TagRecord > crosstags(ncross);
+	string crossqnames;
+	FILE *fp=fopen(crossfile(job).c_str(), "rb");
+	bool ok=fp!=0 && fread(crosstags.data(), sizeof(TagRecord), ncross, fp)==ncross;
+	for (int c; ok && (c=fgetc(fp))!=EOF; ) {
+		crossqnames.push_back(c);
+	}
+	if (fp!=0) fclose(fp);
+	size_t nqnames=count(crossqnames.begin(), crossqnames.end(), '\0');
+	if (! ok || nqnames!=(verify ? ncross : 0) || (! crossqnames.empty() && crossqnames.back()!='\0')) return false;
+	job.crosstags.swap(crosstags);
+	job.crossqnames.swap(crossqnames);
+	job.tagstats=tagstats;
+	job.done=true;
+	return true;
+}
+
+// Restore the chromosomes of <outfile>.manifest if it was written with the
+// same key, and start the manifest again with them. The window files of the
+// jobs are named beforehand.
+int Checkpoint::open(const string &outfile, const string &key, bool verify, vector< unique_ptr< ChrJob > > &jobs) {
+	filename=outfile+".manifest";
+	prefix=outfile;
+	this->verify=verify;
+	map< string, ChrJob * > chr2job;
+	for (unique_ptr< ChrJob > &job : jobs) {
+		chr2job[job->chr]=job.get();
+	}
+	vector< string > lines;
+	ifstream in(filename);
+	string line;
+	if (getline(in, line)) {
+		if (line=="#"+key) {
+			while (getline(in, line)) {
+				string chr=line.substr(0, line.find(' '));
+				map< string, ChrJob * >::iterator it=chr2job.find(chr);
+				if (it!=chr2job.end() && ! it->second->done && restore(*it->second, line)) {
+					lines.push_back(line);
+				}
+			}
+		} else {
+			cout << "Checkpoint " << filename << " is of another run; start over" << endl;
+		}
+	}
+	in.close();
+	if (! lines.empty()) {
+		cout << "Resume " << lines.size() << " of " << jobs.size() << " chromosomes from " << filename << endl;
+	}
+
+	if ((fp=fopen(filename.c_str(), "w"))==0) {
+		cerr << "Error: can not write " << filename << endl;
+		return 1;
+	}
+	fprintf(fp, "#%s\n", key.c_str());
+	for (string &line : lines) {
+		fprintf(fp, "%s\n", line.c_str());
+	}
+	fflush(fp);
+	return 0;
+}
+
+// Save a chromosome whose window files are all written. Called by the worker
+// finishing its last second scan.
+int Checkpoint::add(ChrJob &job) {
+	vector< TagRecord > crosstags;
+	string crossqnames;
+	for (unique_ptr< Window > &window : job.windows) {
+		crosstags.insert(crosstags.end(), window->crosstags.begin(), window->crosstags.end());
+		crossqnames+=window->crossqnames;
+		vector< TagRecord >().swap(window->crosstags);
+		string().swap(window->crossqnames);
+	}
+	string file=crossfile(job);
+	FILE *cross=fopen(file.c_str(), "wb");
+	bool ok=cross!=0 && fwrite(crosstags.data(), sizeof(TagRecord), crosstags.size(), cross)==crosstags.size()
+		&& fwrite(crossqnames.data(), 1, crossqnames.size(), cross)==crossqnames.size();
+	if (cross!=0 && fclose(cross)!=0) {
+		ok=false;
+	}
+	if (! ok) {
+		cerr << "Error: can not write " << file << endl;
+		return 1;
+	}
+
+	ostringstream line;
+	line << job.chr << " " << job.windows.size();
+	for (unique_ptr< Window > &window : job.windows) {
+		int64_t size=-1;
+		filesize(window->outfile, size);
+		line << " " << size;
+	}
+	line << " " << crosstags.size();
+	for (int pair=0; pair<NUMTAGPAIRS; pair++) {
+		line << " " << job.tagstats[pair];
+	}
+	lock_guard< mutex > lock(m);
+	fprintf(fp, "%s\n", line.str().c_str());
+	return fflush(fp)==0 ? 0 : 1;
+}
+
+// Remove the manifest and the cross files after the merge
+void Checkpoint::remove(const vector< unique_ptr< ChrJob > > &jobs) {
+	if (fp!=0) {
+		fclose(fp);
+		fp=0;
+	}
+	::remove(filename.c_str());
+	for (const unique_ptr< ChrJob > &job : jobs) {
+		::remove(crossfile(*job).c_str());
+	}
+}
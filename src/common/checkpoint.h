@@ -0,0 +1,47 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include "chrjob.h"
+
+using namespace std;
+
+// Chromosomes finished by an interrupted filtering run, listed in
+// <outfile>.manifest, so that the run started again with --resume only
+// filters the others before the merge. A line is added when the last window
+// of a chromosome is written: the sizes of its window files, and its tag
+// statistics without the fragments with a mate on another chromosome, which
+// are counted after all chromosomes. The ends of those fragments are saved in
+// <outfile>_<chr>.cross for the cross table, followed by their read names in
+// verify mode. A chromosome is restored only if the manifest was written for
+// the same input and decisions, and its window files have the listed sizes
+// and end with the BGZF EOF block.
+class Checkpoint {
+	private:
+		string filename;
+		string prefix;
+		FILE *fp; // manifest, appended by the workers
+		bool verify; // the cross files keep the read names
+		mutex m;
+	private:
+		string crossfile(const ChrJob &job) const { return prefix+"_"+job.chr+".cross"; }
+		bool restore(ChrJob &job, const string &line);
+	public:
+		Checkpoint():
+			fp(0)
+			, verify(false) { }
+		~Checkpoint() { if (fp!=0) fclose(fp); }
+		Checkpoint(const Checkpoint &)=delete;
+		Checkpoint &operator=(const Checkpoint &)=delete;
+	public:
+		int open(const string &outfile, const string &key, bool verify, vector< unique_ptr< ChrJob > > &jobs);
+		int add(ChrJob &job);
+		void remove(const vector< unique_ptr< ChrJob > > &jobs);
+		bool active() const { return fp!=0; }
+};
+
+#endif
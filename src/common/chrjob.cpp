@@ -0,0 +1,64 @@
+#include <iostream>
+#include <climits>
+#include "chrjob.h"
+
+BamInput::~BamInput() {
+	if (idx!=0) bam_index_destroy(idx);
+	if (header!=0) bam_header_destroy(header);
+}
+
+// Read the header and the index of a BAM file
+int BamInput::load(const string &bamfile) {
+	this->bamfile=bamfile;
+	samfile_t *in=0;
+	if ((in=samopen(bamfile.c_str(), "rb", 0))==0) {
+		cerr << "Error: not found " << bamfile << endl;
+		return 1;
+	}
+	// keep the header beyond samclose()
+	header=in->header;
+	in->header=0;
+	samclose(in);
+	idx = bam_index_load(bamfile.c_str());
+	if (idx==0) {
+		cerr << "Error: not found index file of " << bamfile << endl;
+		return 1;
+	}
+	return 0;
+}
+
+// Create a job for every chromosome in header order, and split chromosomes
+// longer than windowsize into windows aligned to the linear index, unless the
+// index tells that they have no records. The size
+// of a window is estimated from the record count of the chromosome in the
+// index, or from its length if the index has no statistics.
+int loadchrjobs(const BamInput &input, int64_t windowsize, vector< unique_ptr< ChrJob > > &jobs) {
+	if (windowsize>0) {
+		windowsize=(windowsize+WINDOW_ALIGN-1)/WINDOW_ALIGN*WINDOW_ALIGN;
+	}
+	jobs.clear();
+	for (int i=0; i<input.header->n_targets; i++) {
+		unique_ptr< ChrJob > job(new ChrJob());
+		job->chr=input.header->target_name[i];
+		job->tid=i;
+		int64_t len=input.header->target_len[i];
+		uint64_t mapped, unmapped;
+		uint64_t records=len;
+		if (bam_index_stat(input.idx, i, &mapped, &unmapped)==0) {
+			records=mapped+unmapped;
+		}
+		int n=1;
+		if (windowsize>0 && len>windowsize && records>0) {
+			n=(len+windowsize-1)/windowsize;
+		}
+		for (int w=0; w<n; w++) {
+			unique_ptr< Window > window(new Window());
+			window->beg=w==0 ? INT_MIN : w*windowsize;
+			window->end=w==n-1 ? INT_MAX : (w+1)*windowsize;
+			window->size=n==1 ? records : records*windowsize/len;
+			job->windows.push_back(move(window));
+		}
+		jobs.push_back(move(job));
+	}
+	return 0;
+}
@@ -0,0 +1,109 @@
+#ifndef CHRJOB_H
+#define CHRJOB_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include "sam.h"
+#include "tagcode.h"
+#include "qnamedict.h"
+#include "spillruns.h"
+
+using namespace std;
+
+// Bits of Window::seen for every fragment
+#define SEEN_PRIMARY 0x1 // a primary mapping is in the window
+#define SEEN_TAG1 0x2 // the tag of the first end is set in the window
+#define SEEN_TAG2 0x4 // the tag of the second end is set in the window
+#define SEEN_BOUNDARY 0x8 // a mate is mapped outside the window
+#define SEEN_LISTED 0x10 // listed in Window::boundary
+#define SEEN_CROSS 0x20 // a mate is mapped to another chromosome; listed in Window::crossfrags
+
+// Index-aligned range of a chromosome. A window owns the records starting in
+// [beg, end); the first and the last windows are open ended.
+class Window {
+	public:
+		int beg, end;
+		uint64_t size; // estimated number of records
+		QnameDict read2tag; // qname->fragment
+		vector< uint8_t > seen; // fragment->SEEN_* bits
+		vector< pair< uint64_t, uint32_t > > boundary; // qname hash, fragment to reconcile with the other windows
+		bool numbered;
+		size_t numrecords; // numbered by the first scan
+		vector< uint32_t > ordinal2frag; // ordinal->fragment
+		vector< uint32_t > ordinals; // index in ordinal2frag->ordinal, spilled windows only
+		unique_ptr< SpillRuns > runs; // first scan partitioned by read name, or null
+		vector< pair< uint32_t, uint64_t > > crossfrags; // fragment, qname hash resolved by the cross table
+		vector< TagRecord > crosstags; // ends added to the cross table, kept for the checkpoint
+		string crossqnames; // NUL terminated read names of crosstags, verify mode only
+		vector< bool > keep; // ordinal->retained or not
+		vector< pair< uint32_t, uint64_t > > crossrecs; // ordinal, key to look up in the cross table
+		vector< uint8_t > classes; // ordinal->tag pair, kept for the sidecar
+		vector< uint64_t > bins; // ordinal of the first record at or after every WINDOW_ALIGN bp from beg, for the sidecar
+		size_t ordinal;
+		string outfile;
+		string classfile; // classes of the second scan, for the sidecar
+		samfile_t *out;
+	public:
+		Window():
+			beg(0)
+			, end(0)
+			, size(0)
+			, numbered(false)
+			, numrecords(0)
+			, ordinal(0)
+			, out(0) { }
+};
+
+class BamJob;
+
+class ChrJob {
+	public:
+		BamJob *bam; // file of the chromosome
+		string chr;
+		int tid;
+		vector< unique_ptr< Window > > windows;
+		atomic< int > pending; // windows left in the current pass
+		atomic< bool > started;
+		int partitions; // of the first scans by read name; 1 keeps them in memory
+		TagCounts tagstats{}; // tagpair->number
+		bool done; // restored from a checkpoint
+		atomic< bool > failed; // a window failed; the chromosome is not written
+		vector< TagRecord > crosstags; // ends added to the cross table, of a restored chromosome
+		string crossqnames; // NUL terminated read names of crosstags, verify mode only
+	public:
+		ChrJob():
+			bam(0)
+			, tid(-1)
+			, pending(0)
+			, started(false)
+			, partitions(1)
+			, done(false)
+			, failed(false) { }
+};
+
+// Header and index of an input BAM, loaded once and shared read-only by the
+// workers, which only open their own file handle
+class BamInput {
+	public:
+		string bamfile;
+		bam_header_t *header;
+		bam_index_t *idx;
+	public:
+		BamInput():
+			header(0)
+			, idx(0) { }
+		~BamInput();
+		BamInput(const BamInput &)=delete;
+		BamInput &operator=(const BamInput &)=delete;
+	public:
+		int load(const string &bamfile);
+};
+
+#define WINDOW_ALIGN (1<<14) // linear index interval of BAM index
+
+int loadchrjobs(const BamInput &input, int64_t windowsize, vector< unique_ptr< ChrJob > > &jobs);
+
+#endif
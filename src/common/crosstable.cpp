@@ -0,0 +1,68 @@
+#include <cstring>
+#include "crosstable.h"
+
+// Key of the fragment of a read name, or the free key it is added at. Without
+// verify mode the key is the hash, and qname may be NULL.
+uint64_t CrossTable::probe(uint64_t hash, const char *qname) const {
+	uint64_t key=hash;
+	for (;;) {
+		khint_t k=kh_get(qname2cross, h, key);
+		if (k==kh_end(h) || ! verify || 0==strcmp(qnames.c_str()+kh_val(h, k).qnameoff, qname)) {
+			return key;
+		}
+		// different read name of the same hash, probe the next key
+		key=key*0x9e3779b97f4a7c15ULL+1;
+	}
+}
+
+void CrossTable::add(uint64_t hash, const char *qname, uint32_t flag, uint8_t zs, int32_t tid) {
+	lock_guard< mutex > lock(m);
+	int ret;
+	khint_t k=kh_put(qname2cross, h, probe(hash, qname), &ret);
+	CrossFrag &frag=kh_val(h, k);
+	if (ret) {
+		frag.tags=TAGPAIR_NONE;
+		frag.first=false;
+		frag.tid=tid;
+		frag.qnameoff=qnames.size();
+		if (verify) {
+			qnames.append(qname);
+			qnames.push_back('\0');
+		}
+	}
+	frag.tags=settagpair(frag.tags, flag, zs);
+	if (frag.first) return;
+	if (flag & 0x40) {
+		frag.first=true;
+		frag.tid=tid;
+	} else if (tid<frag.tid) {
+		frag.tid=tid;
+	}
+}
+
+// Key of a read name added by an end of its fragment; the workers may still
+// be adding other fragments
+uint64_t CrossTable::key(uint64_t hash, const char *qname) {
+	if (! verify) return hash;
+	lock_guard< mutex > lock(m);
+	return probe(hash, qname);
+}
+
+uint8_t CrossTable::get(uint64_t key) const {
+	khint_t k=kh_get(qname2cross, h, key);
+	return k==kh_end(h) ? TAGPAIR_NONE : kh_val(h, k).tags;
+}
+
+void CrossTable::addtagstats(vector< unique_ptr< ChrJob > > &jobs) const {
+	for (khint_t k=kh_begin(h); k!=kh_end(h); ++k) {
+		if (! kh_exist(h, k)) continue;
+		const CrossFrag &frag=kh_val(h, k);
+		jobs[frag.tid]->tagstats[frag.tags]++;
+	}
+}
+
+void CrossTable::clear() {
+	kh_destroy(qname2cross, h);
+	h=kh_init(qname2cross);
+	string().swap(qnames);
+}
@@ -0,0 +1,58 @@
+#ifndef CROSSTABLE_H
+#define CROSSTABLE_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include "khash.h"
+#include "tagcode.h"
+#include "chrjob.h"
+
+using namespace std;
+
+// Fragment whose ends are mapped to different chromosomes. It is counted in
+// the chromosome of its first end, or of the smallest tid without one, so
+// that the count does not depend on the order of the workers.
+class CrossFrag {
+	public:
+		uint8_t tags;
+		bool first; // tid is the chromosome of the first end
+		int32_t tid;
+		uint64_t qnameoff; // offset in CrossTable::qnames, verify mode only
+};
+
+// 64-bit hash of a read name -> cross-chromosome fragment
+KHASH_MAP_INIT_INT64(qname2cross, CrossFrag)
+
+// Tag pairs of the fragments with ends on different chromosomes, shared by
+// the workers. Every end adds its tag in the first scan of its chromosome,
+// and the table is only read after all first scans. In verify mode the read
+// names are kept, and colliding names probe successive keys as in QnameDict;
+// a fragment is then looked up by the key its name resolved to.
+class CrossTable {
+	public:
+		bool verify;
+	private:
+		khash_t(qname2cross) *h;
+		string qnames; // NUL terminated read names, verify mode only
+		mutex m;
+	private:
+		uint64_t probe(uint64_t hash, const char *qname) const;
+	public:
+		CrossTable():
+			verify(false)
+			, h(kh_init(qname2cross)) { }
+		~CrossTable() { kh_destroy(qname2cross, h); }
+		CrossTable(const CrossTable &)=delete;
+		CrossTable &operator=(const CrossTable &)=delete;
+	public:
+		void add(uint64_t hash, const char *qname, uint32_t flag, uint8_t zs, int32_t tid);
+		uint64_t key(uint64_t hash, const char *qname);
+		uint8_t get(uint64_t key) const;
+		void addtagstats(vector< unique_ptr< ChrJob > > &jobs) const;
+		void clear();
+};
+
+#endif
@@ -0,0 +1,125 @@
+#include "matebuffer.h"
+#include "chrjob.h"
+
+MateBuffer::~MateBuffer() {
+	kh_destroy(qname2frag, h);
+	for (pair< bam1_t *, uint32_t > &held : queue) {
+		bam_destroy1(held.first);
+	}
+	for (bam1_t *b : freerecords) {
+		bam_destroy1(b);
+	}
+}
+
+uint32_t MateBuffer::getfrag(uint64_t hash, int32_t pos) {
+	int ret;
+	khint_t k=kh_put(qname2frag, h, hash, &ret);
+	if (! ret) {
+		return kh_val(h, k);
+	}
+	uint32_t f;
+	if (freefrags.empty()) {
+		f=frags.size();
+		frags.push_back(StreamFrag());
+		frags[f].gen=0;
+	} else {
+		f=freefrags.back();
+		freefrags.pop_back();
+		frags[f].gen++;
+	}
+	StreamFrag &frag=frags[f];
+	frag.hash=hash;
+	frag.deadline=pos;
+	frag.held=0;
+	frag.tags=TAGPAIR_NONE;
+	frag.seen=0;
+	frag.expect=0;
+	frag.decided=false;
+	kh_val(h, k)=f;
+	deadlines.push(make_pair(pos, make_pair(f, frags[f].gen)));
+	return f;
+}
+
+void MateBuffer::setdeadline(uint32_t f, int32_t pos) {
+	if (pos>frags[f].deadline) {
+		frags[f].deadline=pos;
+		deadlines.push(make_pair(pos, make_pair(f, frags[f].gen)));
+	}
+}
+
+void MateBuffer::decide(uint32_t f) {
+	StreamFrag &frag=frags[f];
+	frag.decided=true;
+	kh_del(qname2frag, h, kh_get(qname2frag, h, frag.hash));
+	// skip reads with secondary mappings only
+	if (frag.tags!=TAGPAIR_NONE) {
+		tagstats[frag.tags]++;
+	}
+	if (frag.held==0) {
+		freefrags.push_back(f);
+	}
+}
+
+// Queue a record of the chromosome; the records come in coordinate order
+void MateBuffer::push(const bam1_t *b) {
+	uint32_t f=getfrag(hashqname(bam1_qname(b), b->core.l_qname-1), b->core.pos);
+	bam1_t *copy;
+	if (freerecords.empty()) {
+		copy=bam_init1();
+	} else {
+		copy=freerecords.back();
+		freerecords.pop_back();
+	}
+	bam_copy1(copy, b);
+	queue.push_back(make_pair(copy, f));
+	StreamFrag &frag=frags[f];
+	frag.held++;
+
+	uint32_t flag=b->core.flag;
+	bool matehere=(flag & 0x1) && b->core.mtid==b->core.tid
+		&& (int64_t)b->core.mpos-b->core.pos<=maxdistance;
+	if (flag & 0x100) {
+		// Follow the decision of the primary pair, expected up to the mate
+		setdeadline(f, matehere ? b->core.mpos : b->core.pos);
+		return;
+	}
+	frag.tags=settagpair(frag.tags, flag, zscode(b));
+	if (flag & 0x40) {
+		frag.seen|=SEEN_TAG1;
+		if (matehere) frag.expect|=SEEN_TAG2;
+	} else if (flag & 0x80) {
+		frag.seen|=SEEN_TAG2;
+		if (matehere) frag.expect|=SEEN_TAG1;
+	}
+	if (matehere) {
+		setdeadline(f, b->core.mpos);
+	}
+	if ((frag.expect & ~frag.seen)==0) {
+		decide(f);
+	}
+}
+
+// Decide the fragments whose mates should have come before pos
+void MateBuffer::evict(int32_t pos) {
+	while (! deadlines.empty() && deadlines.top().first<pos) {
+		Deadline d=deadlines.top();
+		deadlines.pop();
+		StreamFrag &frag=frags[d.second.first];
+		if (frag.gen!=d.second.second || frag.decided || frag.deadline!=d.first) continue;
+		decide(d.second.first);
+	}
+}
+
+const bam1_t *MateBuffer::front(uint8_t &tags) const {
+	tags=frags[queue.front().second].tags;
+	return queue.front().first;
+}
+
+void MateBuffer::pop() {
+	uint32_t f=queue.front().second;
+	freerecords.push_back(queue.front().first);
+	queue.pop_front();
+	if (--frags[f].held==0 && frags[f].decided) {
+		freefrags.push_back(f);
+	}
+}
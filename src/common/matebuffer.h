@@ -0,0 +1,70 @@
+#ifndef MATEBUFFER_H
+#define MATEBUFFER_H
+
+#include <stdint.h>
+#include <deque>
+#include <queue>
+#include <vector>
+#include "sam.h"
+#include "tagcode.h"
+#include "qnamedict.h"
+
+using namespace std;
+
+// Fragment of the coordinate-sorted stream waiting for its mates. expect has
+// the SEEN_TAG1/SEEN_TAG2 bits of the ends whose mates are announced on this
+// chromosome by mtid/mpos; the fragment is decided when they are all seen or
+// the scan passes deadline, the last announced mate position.
+class StreamFrag {
+	public:
+		uint64_t hash;
+		uint32_t gen; // generation of the slot, to skip stale deadlines
+		int32_t deadline;
+		uint32_t held; // records in the reorder queue
+		uint8_t tags;
+		uint8_t seen;
+		uint8_t expect;
+		bool decided;
+};
+
+// Single-pass pairing of a coordinate-sorted chromosome. Records are queued
+// in input order, and leave the queue in the same order once the fragments
+// are decided, so the memory is bound by the spread of the mate positions
+// rather than by the depth of the chromosome. A mate announced farther than
+// maxdistance is not waited for, as one on another chromosome, so that a
+// distant pair does not hold the records between its ends. A fragment is
+// forgotten once decided; a record of it arriving later starts a new
+// fragment.
+class MateBuffer {
+	private:
+		khash_t(qname2frag) *h; // pending fragments
+		vector< StreamFrag > frags;
+		vector< uint32_t > freefrags;
+		deque< pair< bam1_t *, uint32_t > > queue; // record, fragment
+		vector< bam1_t * > freerecords;
+		typedef pair< int32_t, pair< uint32_t, uint32_t > > Deadline; // position, fragment, generation
+		priority_queue< Deadline, vector< Deadline >, greater< Deadline > > deadlines;
+	public:
+		TagCounts tagstats{}; // tagpair->number of the decided fragments
+		int32_t maxdistance; // bp past which a mate is not waited for
+	public:
+		MateBuffer(int32_t maxdistance):
+			h(kh_init(qname2frag))
+			, maxdistance(maxdistance) { }
+		~MateBuffer();
+		MateBuffer(const MateBuffer &)=delete;
+		MateBuffer &operator=(const MateBuffer &)=delete;
+	public:
+		void push(const bam1_t *b);
+		void evict(int32_t pos);
+		bool ready() const { return ! queue.empty() && frags[queue.front().second].decided; }
+		const bam1_t *front(uint8_t &tags) const;
+		void pop();
+		bool empty() const { return queue.empty(); }
+	private:
+		uint32_t getfrag(uint64_t hash, int32_t pos);
+		void setdeadline(uint32_t f, int32_t pos);
+		void decide(uint32_t f);
+};
+
+#endif
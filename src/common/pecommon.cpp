@@ -0,0 +1,1756 @@
+#include <map>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <set>
+#include <iterator>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <climits>
+#include <cmath>
+#include <random>
+#include <future>
+#include <sstream>
+#include <fstream>
+#include <mutex>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "sam.h"
+#include "pecommon.h"
+#include "qnamedict.h"
+#include "chrjob.h"
+#include "taskqueue.h"
+#include "matebuffer.h"
+#include "crosstable.h"
+#include "sidecar.h"
+#include "checkpoint.h"
+#include "bamjob.h"
+
+using namespace std;
+
+Opts opts;
+
+// BGZF blocks read ahead for every decompressing thread. A fetch reads at
+// most this many blocks beyond its region.
+#define READAHEAD_BLOCKS 4
+// BGZF blocks compressed in a batch by every compressing thread
+#define COMPRESS_BLOCKS 64
+// Estimated bytes of the first scan dictionaries per record: the hash table
+// and the tags of half a fragment, and the ordinal. Verify mode adds the read
+// name of half a fragment and its offset.
+#define DICT_BYTES_PER_RECORD 16
+#define QNAME_BYTES_PER_RECORD 24
+// Most runs of a window, each an open file while the window is scanned
+#define MAX_PARTITIONS 64
+// Estimated records of a window per run file; the partitions of a smaller
+// window share files
+#define RUN_RECORDS 65536
+// Library type estimate: regions sampled across the references, records read
+// from a region, most primary mappings counted, and the standard deviations
+// that decide the test
+#define LIBTYPE_REGIONS 4096
+#define LIBTYPE_RECORDS 1000
+#define LIBTYPE_MAPPINGS 1000000
+#define LIBTYPE_Z 3.0
+#define LIBTYPE_SEED 1
+// Library type estimate of a stream: most records held before the output,
+// and records between the tests
+#define STREAM_LIBTYPE_RECORDS 100000
+#define STREAM_LIBTYPE_CHECK 10000
+// Approximate statistics: size of the sampled regions, bp past a region read
+// for the mates of its fragments, and the normal quantile of the intervals
+#define APPROX_REGION 100000
+#define APPROX_EXTEND 10000
+#define APPROX_Z 1.96
+
+// Storage of released dictionaries, one per worker
+static QnameDictPool dictpool;
+
+// From samtools 0.1.19
+// callback function for bam_fetch() that prints nonskipped records
+
+// Prefix of the temporary files in $TMPDIR, or /tmp
+static string tmpprefix() {
+	const char *tmpdir=getenv("TMPDIR");
+	return string(tmpdir ? tmpdir : "/tmp")+"/pefilter."+to_string(getpid());
+}
+
+// Add a record of the first scan to the dictionary of the window. The read
+// name is only used in verify mode. The ends with a mate on another
+// chromosome are collected for the cross table.
+static void addrecord(Window &window, const TagRecord &rec, const char *qname, size_t len) {
+	QnameDict &read2tag=window.read2tag; // qname->fragment
+	uint32_t i=read2tag.get(qname, len, rec.hash);
+	if (i==window.seen.size()) {
+		window.seen.push_back(0);
+	}
+	if (window.numbered) {
+		window.ordinal2frag.push_back(i);
+		if (window.runs) {
+			window.ordinals.push_back(rec.ordinal);
+		}
+	}
+	uint8_t &seen=window.seen[i];
+	if (rec.flag & 0x100) {
+		// Follow the decision of the primary pair, which may be in another window
+		if (! (seen & SEEN_LISTED)) {
+			seen|=SEEN_LISTED;
+			window.boundary.push_back(make_pair(rec.hash, i));
+		}
+		return;
+	}
+
+	read2tag.frags[i]=settagpair(read2tag.frags[i], rec.flag, rec.zs);
+	seen|=SEEN_PRIMARY;
+	if (rec.flag & 0x40) {
+		seen|=SEEN_TAG1;
+	} else if (rec.flag & 0x80) {
+		seen|=SEEN_TAG2;
+	}
+	if (rec.bits & TAGREC_CROSS) {
+		window.crosstags.push_back(rec);
+		if (read2tag.verify) {
+			window.crossqnames.append(qname, len);
+			window.crossqnames.push_back('\0');
+		}
+		if (! (seen & SEEN_CROSS)) {
+			seen|=SEEN_CROSS;
+			window.crossfrags.push_back(make_pair(i, rec.hash));
+		}
+	}
+	if (rec.bits & TAGREC_BOUNDARY) {
+		seen|=SEEN_BOUNDARY;
+		if (! (seen & SEEN_LISTED)) {
+			seen|=SEEN_LISTED;
+			window.boundary.push_back(make_pair(rec.hash, i));
+		}
+	}
+}
+
+// The first scan of a window. When numbered, every record gets an ordinal and
+// its fragment is remembered, so that the second scan, which visits the same
+// records in the same order, only looks up keep. A spilled window writes the
+// records to its runs instead.
+static int addtag(const bam1_t *b, void *data) {
+	Window *window=(Window*)data;
+	// bam_fetch() also returns the records overlapping the window from the left
+	if (b->core.pos<window->beg || b->core.pos>=window->end) return 1;
+	uint32_t flag=b->core.flag;
+	// Skip the multiple mapping @ 20191125
+	if ((flag & 0x100) && ! window->numbered) return 1;
+
+	TagRecord rec;
+	rec.hash=hashqname(bam1_qname(b), b->core.l_qname-1);
+	rec.ordinal=window->numrecords++;
+	rec.flag=flag;
+	rec.zs=(flag & 0x100) ? (uint8_t)ZS_N : zscode(b);
+	rec.bits=0;
+	if ((flag & 0x1) && b->core.mtid>=0 && b->core.mtid!=b->core.tid) {
+		rec.bits|=TAGREC_CROSS;
+	}
+	if (b->core.mtid==b->core.tid && (b->core.mpos<window->beg || b->core.mpos>=window->end)) {
+		rec.bits|=TAGREC_BOUNDARY;
+	}
+	if (window->runs) {
+		window->runs->write(rec, bam1_qname(b), b->core.l_qname-1);
+		return 0;
+	}
+	addrecord(*window, rec, bam1_qname(b), b->core.l_qname-1);
+	return 0;
+}
+
+static void addtagstats(QnameDict &read2tagchr, TagCounts &tagstatschr) {
+	for (uint8_t pair : read2tagchr.frags) {
+		// skip reads with secondary mappings only
+		if (pair==TAGPAIR_NONE) continue;
+		tagstatschr[pair]++;
+	}
+}
+
+static void printtagstats(TagCounts &tagstats, ostream &out=cout) {
+	for (int pair=0; pair<NUMTAGPAIRS; pair++) {
+		if (tagstats[pair]>0) {
+			out << tagpairname(pair) << "\t" << tagstats[pair] << endl;
+		}
+	}
+}
+
+// Per-chromosome breakdown of the tag statistics, one line per chromosome and
+// tag pair
+static void printchrtagstats(vector< unique_ptr< ChrJob > > &jobs) {
+	cout << "Number of PE tags per chromosome:" << endl;
+	for (unique_ptr< ChrJob > &job : jobs) {
+		for (int pair=0; pair<NUMTAGPAIRS; pair++) {
+			if (job->tagstats[pair]>0) {
+				cout << job->chr << "\t" << tagpairname(pair) << "\t" << job->tagstats[pair] << endl;
+			}
+		}
+	}
+}
+
+// Boundary exchange after the first scans of all windows of a chromosome.
+// A listed fragment gets the tag pair the whole chromosome would give it, by
+// replaying its tags in the windows in fetch order, and it is counted in the
+// first window holding a primary mapping of it. The other fragments have all
+// their mappings in their own window and are counted there.
+static void reconcilechr(ChrJob &job) {
+	int n=job.windows.size();
+	vector< vector< uint8_t > > merged(n);
+	vector< vector< bool > > mergedcross(n);
+	for (int k=0; n>1 && k<n; k++) {
+		Window &window=*job.windows[k];
+		for (pair< uint64_t, uint32_t > &bf : window.boundary) {
+			const char *qname=window.read2tag.verify ? window.read2tag.getqname(bf.second) : 0;
+			uint8_t tags=TAGPAIR_NONE;
+			bool cross=false;
+			int first=-1;
+			for (int j=0; j<n; j++) {
+				Window &other=*job.windows[j];
+				int64_t f=j==k ? bf.second : other.read2tag.find(qname, bf.first);
+				if (f<0 || ! (other.seen[f] & SEEN_PRIMARY)) continue;
+				if (first<0) first=j;
+				if (tags==TAGPAIR_NONE) tags=TAGPAIR_NN;
+				uint8_t local=other.read2tag.frags[f];
+				if (other.seen[f] & SEEN_TAG1) tags=tagpair(tagpair1(local), tagpair2(tags));
+				if (other.seen[f] & SEEN_TAG2) tags=tagpair(tagpair1(tags), tagpair2(local));
+				if (other.seen[f] & SEEN_CROSS) cross=true;
+			}
+			merged[k].push_back(tags);
+			mergedcross[k].push_back(cross);
+			if (first==k && ! cross) {
+				job.tagstats[tags]++;
+			}
+		}
+	}
+	// Fragments with a mate on another chromosome are counted from the cross
+	// table once all chromosomes are scanned
+	for (int k=0; k<n; k++) {
+		Window &window=*job.windows[k];
+		for (size_t b=0; n>1 && b<window.boundary.size(); b++) {
+			uint32_t i=window.boundary[b].second;
+			window.read2tag.frags[i]=merged[k][b];
+			if (mergedcross[k][b] && ! (window.seen[i] & SEEN_CROSS)) {
+				window.seen[i]|=SEEN_CROSS;
+				window.crossfrags.push_back(make_pair(i, window.boundary[b].first));
+			}
+		}
+		for (size_t i=0; i<window.seen.size(); i++) {
+			if ((window.seen[i] & SEEN_PRIMARY) && ! (window.seen[i] & (SEEN_CROSS | (n>1 ? SEEN_LISTED : 0)))) {
+				job.tagstats[window.read2tag.frags[i]]++;
+			}
+		}
+	}
+}
+
+void calpostiverate(TagCounts & tagstats, bool pico, uint64_t & total, uint64_t & postivenumber) {
+	total=0;
+	postivenumber=0;
+	for (int pair=0; pair<NUMTAGPAIRS; pair++) {
+		total += tagstats[pair];
+	}
+	const uint8_t *validtags=pico ? validtags_pico : validtags_trad;
+	for (int pair=0; pair<NUMTAGPAIRS; pair++) {
+		if (validtags[pair]) {
+			postivenumber+=tagstats[pair];
+		}
+	}
+}
+
+// Open a BAM file, or a SAM file in the streaming mode, for reading in order.
+// `-` is standard input, whose format can not be detected without reading it.
+static samfile_t *openinput(const string &infile) {
+	bool streaming=opts.namesorted || opts.coordinatesorted;
+	bool isbam=! opts.saminput && (! streaming || infile=="-" || bgzf_is_bgzf(infile.c_str()));
+	samfile_t *in=0;
+	if ((in=samopen(infile.c_str(), isbam ? "rb" : "r", 0))==0) {
+		cerr << "Error: not found " << infile << endl;
+		return 0;
+	}
+	if (isbam && opts.readthreads>0) {
+		bgzf_mt_read(in->x.bam, opts.readthreads, READAHEAD_BLOCKS);
+	}
+	return in;
+}
+
+// Tag pair of a primary mapping of the first records of a stream
+static void addtoptag(QnameDict &read2tagtop, const bam1_t *b) {
+	uint32_t i=read2tagtop.get(bam1_qname(b), b->core.l_qname-1);
+	read2tagtop.frags[i]=settagpair(read2tagtop.frags[i], b->core.flag, zscode(b));
+}
+
+// Whether neither of two counts is 10 times the other, as a Wilson score
+// interval of x/(x+y) at 3 standard deviations tells: 1 if surely, 0 if surely
+// not, -1 if not yet decided
+static int balancedpair(uint64_t x, uint64_t y) {
+	double n=x+y;
+	if (n==0) return -1;
+	double p=x/n;
+	double z2=LIBTYPE_Z*LIBTYPE_Z;
+	double center=(p+z2/(2*n))/(1+z2/n);
+	double half=LIBTYPE_Z*sqrt(p*(1-p)/n+z2/(4*n*n))/(1+z2/n);
+	if (center-half>1.0/11 && center+half<10.0/11) return 1;
+	if (center+half<1.0/11 || center-half>10.0/11) return 0;
+	return -1;
+}
+
+// Pico libraries have both orders of a pair of tags: 1 if Pico, 0 if
+// traditional, -1 if the counts do not tell yet
+static int testlibtype(TagCounts &tagstatstop) {
+	int pp=balancedpair(tagstatstop[tagpair(ZS_PP, ZS_PM)], tagstatstop[tagpair(ZS_PM, ZS_PP)]);
+	int mm=balancedpair(tagstatstop[tagpair(ZS_MP, ZS_MM)], tagstatstop[tagpair(ZS_MM, ZS_MP)]);
+	if (pp==1 || mm==1) return 1;
+	if ((pp==0 && mm!=1) || (mm==0 && pp!=1)) return 0;
+	return -1;
+}
+
+// Whether the tag pairs of a sample are of the Pico protocol
+static bool decidelibtype(TagCounts &tagstatstop, const string &sample, ostream &out=cout) {
+	uint64_t pp_pm=tagstatstop[tagpair(ZS_PP, ZS_PM)];
+	uint64_t pm_pp=tagstatstop[tagpair(ZS_PM, ZS_PP)];
+	uint64_t mp_mm=tagstatstop[tagpair(ZS_MP, ZS_MM)];
+	uint64_t mm_mp=tagstatstop[tagpair(ZS_MM, ZS_MP)];
+	bool detectpico=false;
+	if ((pp_pm>0 && pm_pp>0
+				&& pp_pm<10*pm_pp
+				&& pm_pp<10*pp_pm)
+			|| (mp_mm>0 && mm_mp>0
+				&& mp_mm<10*mm_mp
+				&& mm_mp<10*mp_mm
+				))
+	{
+		detectpico=true;
+	}
+
+	out << "Number of PE tags in " << sample << ":" << endl;
+	printtagstats(tagstatstop, out);
+
+	uint64_t total=0;
+	uint64_t postivenumber=0;
+	calpostiverate(tagstatstop, detectpico, total, postivenumber);
+	out << "total reads: " << total << "; positive reads: " << postivenumber << endl;
+	if (total>0) {
+		double rate=1.0*postivenumber/total;
+		out << "Positive rate: " << rate << endl;
+	}
+
+	if (detectpico) {
+		out << "Pico library construction detected. Retain 12 PE mapping pairs:\n(++,+-), (+-,++), (-+,--), (--,-+), (++,N), (N,++), (+-,N), (N,+-), (-+,N), (N,-+), (--,N), (N,--)" << endl;
+	} else {
+		out << "Traditional library construction detected. Retain 6 PE mapping pairs:\n(++,+-), (-+,--), (++,N), (N,+-), (-+,N), (N,--)" << endl;
+	}
+	return detectpico;
+}
+
+// Regions sampled across all references to estimate the library type, and
+// the tag pairs of their fragments
+class LibSample {
+	public:
+		const BamInput *input;
+		vector< pair< int32_t, int32_t > > points; // tid, start of a region
+		atomic< size_t > next;
+		atomic< bool > stop;
+		mutex m;
+		TagCounts tagstats{};
+		uint64_t mappings;
+		size_t regions;
+	public:
+		LibSample(const BamInput *input):
+			input(input)
+			, next(0)
+			, stop(false)
+			, mappings(0)
+			, regions(0) { }
+};
+
+// Start points spread evenly over every reference by its share of the
+// records, from its start, visited in a fixed random order, so that early
+// stopping sees the whole genome
+static void samplepoints(LibSample &sample) {
+	const BamInput &input=*sample.input;
+	vector< uint64_t > records(input.header->n_targets);
+	uint64_t total=0;
+	for (int i=0; i<input.header->n_targets; i++) {
+		uint64_t mapped, unmapped;
+		records[i]=input.header->target_len[i];
+		if (bam_index_stat(input.idx, i, &mapped, &unmapped)==0) {
+			records[i]=mapped;
+		}
+		total+=records[i];
+	}
+	for (int i=0; total>0 && i<input.header->n_targets; i++) {
+		uint64_t n=(records[i]*LIBTYPE_REGIONS+total-1)/total;
+		int64_t len=input.header->target_len[i];
+		for (uint64_t j=0; j<n; j++) {
+			sample.points.push_back(make_pair(i, (int32_t)(j*len/n)));
+		}
+	}
+	shuffle(sample.points.begin(), sample.points.end(), mt19937(LIBTYPE_SEED));
+}
+
+// Read up to LIBTYPE_RECORDS records from every region taken, and count the
+// fragments whose primary ends are all in the region: mates elsewhere would
+// bias the pair towards N. Stop when the test decides or enough mappings are
+// counted.
+static void sampleworker(LibSample *sample) {
+	BGZF *fp=bgzf_open(sample->input->bamfile.c_str(), "r");
+	if (fp==0) {
+		return;
+	}
+	bam1_t *b=bam_init1();
+	size_t k;
+	while (! sample->stop && (k=sample->next++)<sample->points.size()) {
+		int32_t tid=sample->points[k].first;
+		int32_t beg=sample->points[k].second;
+		QnameDict read2tag; // qname->fragment
+		vector< uint8_t > missing; // fragment->primary ends not read yet
+		bam_iter_t iter=bam_iter_query(sample->input->idx, tid, beg, 1<<29);
+		int n=0;
+		uint64_t mappings=0;
+		while (n<LIBTYPE_RECORDS && bam_iter_read(fp, iter, b)>=0) {
+			if (b->core.pos<beg) continue; // overlapping from the left
+			n++;
+			uint32_t flag=b->core.flag;
+			if (flag & 0x100) continue;
+			mappings++;
+			uint32_t f=read2tag.get(bam1_qname(b), b->core.l_qname-1);
+			if (f==missing.size()) {
+				bool mate=(flag & 0x1) && ! (flag & 0x8) && b->core.mtid==tid && b->core.mpos>=beg;
+				missing.push_back(mate ? 2 : 1);
+			}
+			if (missing[f]>0) {
+				missing[f]--;
+			}
+			read2tag.frags[f]=settagpair(read2tag.frags[f], flag, zscode(b));
+		}
+		bam_iter_destroy(iter);
+		TagCounts tagstats{};
+		for (size_t f=0; f<missing.size(); f++) {
+			if (missing[f]==0 && read2tag.frags[f]!=TAGPAIR_NONE) {
+				tagstats[read2tag.frags[f]]++;
+			}
+		}
+		lock_guard< mutex > lock(sample->m);
+		for (int pair=0; pair<NUMTAGPAIRS; pair++) {
+			sample->tagstats[pair]+=tagstats[pair];
+		}
+		sample->mappings+=mappings;
+		sample->regions++;
+		if (testlibtype(sample->tagstats)>=0 || sample->mappings>=LIBTYPE_MAPPINGS) {
+			sample->stop=true;
+		}
+	}
+	bam_destroy1(b);
+	bgzf_close(fp);
+}
+
+// Estimate the library type from regions sampled through the index on
+// opts.numthreads threads; return whether it is Pico. It may run while the
+// workers read opts, so it does not set opts.pico.
+static bool estimatelibtype(const BamInput &input) {
+	if (! opts.validtags.empty()) {
+		cout << "Using customized PE tags" << endl;
+		return opts.pico;
+	}
+	LibSample sample(&input);
+	samplepoints(sample);
+	int n=max< size_t >(1, min< size_t >(opts.numthreads, sample.points.size()));
+	vector< thread > threads;
+	for (int i=0; i<n; i++) {
+		threads.push_back(thread(sampleworker, &sample));
+	}
+	for (thread &th : threads) {
+		th.join();
+	}
+	// one write, as the workers may be running
+	ostringstream report;
+	bool pico=decidelibtype(sample.tagstats, to_string(sample.regions)+" sampled regions", report);
+	cout << report.str() << flush;
+	return pico;
+}
+
+// Decision of every tag pair byte in the streaming modes
+uint8_t validpairs[256];
+// Compile the decision of every tag pair byte from the protocol or
+// -d/--validtag before filtering. Bytes beyond the tag pairs, TAGPAIR_NONE
+// included, are 0.
+static void compilevalidtags(uint8_t *validpairs, bool pico) {
+	memset(validpairs, 0, 256);
+	if (! opts.validtags.empty()) {
+		for (const string &tag : opts.validtags) {
+			int pair=parsetagpair(tag);
+			if (pair>=0) {
+				validpairs[pair]=1;
+			}
+		}
+	} else {
+		memcpy(validpairs, pico ? validtags_pico : validtags_trad, NUMTAGPAIRS);
+	}
+}
+
+// Resolve the pair decision of every numbered record after the first scans
+// of the chromosome, or of a partition of it; keep is sized beforehand. The
+// records of fragments with a mate on another chromosome are listed, to be
+// resolved from the cross table.
+static void resolvekeep(BamJob &bam, Window &window) {
+	vector< uint8_t > &frags=window.read2tag.frags;
+	map< uint32_t, uint64_t > crosshash(window.crossfrags.begin(), window.crossfrags.end());
+	// colliding read names are told apart by the keys they resolved to
+	if (window.read2tag.verify) {
+		for (pair< const uint32_t, uint64_t > &frag : crosshash) {
+			frag.second=bam.crosstable.key(frag.second, window.read2tag.getqname(frag.first));
+		}
+	}
+	// multiple mapping in both ends is TAGPAIR_NONE and never valid
+	for (size_t i=0; i<window.ordinal2frag.size(); i++) {
+		uint32_t f=window.ordinal2frag[i];
+		uint32_t ordinal=window.ordinals.empty() ? i : window.ordinals[i];
+		if (window.seen[f] & SEEN_CROSS) {
+			window.crossrecs.push_back(make_pair(ordinal, crosshash[f]));
+		} else {
+			window.keep[ordinal]=bam.validpairs[frags[f]];
+			if (! window.classes.empty()) {
+				window.classes[ordinal]=frags[f];
+			}
+		}
+	}
+	vector< uint32_t >().swap(window.ordinal2frag);
+	vector< uint32_t >().swap(window.ordinals);
+}
+
+static void resolvecrosskeep(BamJob &bam, Window &window) {
+	for (pair< uint32_t, uint64_t > &rec : window.crossrecs) {
+		uint8_t tags=bam.crosstable.get(rec.second);
+		window.keep[rec.first]=bam.validpairs[tags];
+		if (! window.classes.empty()) {
+			window.classes[rec.first]=tags;
+		}
+	}
+	vector< pair< uint32_t, uint64_t > >().swap(window.crossrecs);
+}
+
+static int filter_keep(const bam1_t *b, void *data) {
+	Window *window=(Window*)data;
+	if (b->core.pos<window->beg || b->core.pos>=window->end) return 1;
+	if (! window->classes.empty()) {
+		size_t bin=b->core.pos/WINDOW_ALIGN-max(window->beg, 0)/WINDOW_ALIGN;
+		while (window->bins.size()<=bin) {
+			window->bins.push_back(window->ordinal);
+		}
+	}
+	if (window->ordinal<window->keep.size() && window->keep[window->ordinal]) {
+		samwrite(window->out, b);
+	}
+	window->ordinal++;
+	return 0;
+}
+
+static void releasewindow(Window &window) {
+	dictpool.give(window.read2tag);
+	vector< uint8_t >().swap(window.seen);
+	vector< pair< uint64_t, uint32_t > >().swap(window.boundary);
+	vector< pair< uint32_t, uint64_t > >().swap(window.crossfrags);
+}
+
+// Add the ends with a mate on another chromosome to the cross table of the
+// file, the ends from index from and their read names from offset qnamefrom
+// of the window. A checkpoint keeps them until the chromosome is written.
+static void addcrosstags(ChrJob &job, Window &window, size_t from, size_t qnamefrom) {
+	BamJob &bam=*job.bam;
+	const char *qname=window.crossqnames.c_str()+qnamefrom;
+	for (size_t i=from; i<window.crosstags.size(); i++) {
+		const TagRecord &rec=window.crosstags[i];
+		bam.crosstable.add(rec.hash, qname, rec.flag, rec.zs, job.tid);
+		if (bam.crosstable.verify) {
+			qname+=strlen(qname)+1;
+		}
+	}
+	if (! bam.checkpoint.active()) {
+		vector< TagRecord >().swap(window.crosstags);
+		string().swap(window.crossqnames);
+	}
+}
+
+// Chromosome in the messages; a batch also names the file
+static string chrlabel(const ChrJob &job) {
+	return opts.batch.empty() ? job.chr : job.chr+" of "+job.bam->input.bamfile;
+}
+
+atomic< bool > failed(false);
+
+// Replay partition p of the runs of every window of a spilled chromosome
+// into the dictionaries of the windows
+static int loadpartition(ChrJob &job, int p) {
+	char qname[256];
+	for (unique_ptr< Window > &window : job.windows) {
+		SpillRuns &runs=*window->runs;
+		size_t from=window->crosstags.size();
+		size_t qnamefrom=window->crossqnames.size();
+		dictpool.take(window->read2tag);
+		window->read2tag.reserve(window->size/job.partitions);
+		if (runs.start(p)!=0) {
+			cerr << "Error: can not read " << runs.name(p) << endl;
+			return 1;
+		}
+		TagRecord rec;
+		size_t len;
+		int r;
+		while ((r=runs.next(p, rec, qname, len))>0) {
+			addrecord(*window, rec, qname, len);
+		}
+		if (r<0) {
+			cerr << "Error: truncated " << runs.name(p) << endl;
+			return 1;
+		}
+		runs.remove(p);
+		addcrosstags(job, *window, from, qnamefrom);
+	}
+	return 0;
+}
+
+// First scan of a window into its dictionary, or into its runs when the
+// chromosome is spilled
+static int scanwindow(BGZF *fp, ChrJob &job, int w, bool filter) {
+	BamJob &bam=*job.bam;
+	Window &window=*job.windows[w];
+	if (fp==0) return 1;
+	window.numbered=filter;
+	window.read2tag.verify=opts.verifyqname;
+	if (job.partitions>1) {
+		window.runs.reset(new SpillRuns());
+		string prefix=bam.tmpprefix+"_"+job.chr+"_"+to_string(w);
+		window.runs->open(prefix, job.partitions, (window.size+RUN_RECORDS-1)/RUN_RECORDS, opts.verifyqname);
+	} else {
+		dictpool.take(window.read2tag);
+		window.read2tag.reserve(window.size);
+	}
+	int result=bam_fetch(fp, bam.input.idx, job.tid, max(window.beg, 0), min(window.end, 1<<29), &window, addtag);
+	if (result<0) {
+		cerr << "Error: failed to retrieve region " << chrlabel(job) << endl;
+		return 1;
+	}
+	if (window.runs && window.runs->close()!=0) {
+		cerr << "Error: can not write the runs of " << chrlabel(job) << " in " << bam.tmpprefix << "_*" << endl;
+		return 1;
+	}
+	if (! window.runs) {
+		addcrosstags(job, window, 0, 0);
+	}
+	return 0;
+}
+
+// Reconcile the windows of a chromosome whose first scans are done, and
+// resolve the decisions of its records if filtering; cross is set if some
+// need the cross table
+static int reconcilejob(ChrJob &job, bool filter, bool &cross) {
+	BamJob &bam=*job.bam;
+	if (filter && bam.validready.valid()) {
+		bam.validready.wait();
+	}
+	for (unique_ptr< Window > &other : job.windows) {
+		if (filter) {
+			other->keep.assign(other->numrecords, false);
+		}
+		if (filter && bam.keepclasses) {
+			other->classes.assign(other->numrecords, TAGPAIR_NONE);
+		}
+	}
+	for (int p=0; p<job.partitions; p++) {
+		if (job.partitions>1 && loadpartition(job, p)!=0) {
+			return 1;
+		}
+		reconcilechr(job);
+		for (unique_ptr< Window > &other : job.windows) {
+			if (filter) {
+				resolvekeep(bam, *other);
+				cross=cross || ! other->crossrecs.empty();
+			}
+			releasewindow(*other);
+		}
+	}
+	return 0;
+}
+
+// 1. First scan to construct the tag directionary of a window. The worker
+// finishing the last window of a chromosome reconciles the windows, and
+// queues the second scans if filtering. The dictionaries are released then;
+// the second scans of a chromosome with mates on other chromosomes wait for
+// all first scans. A spilled chromosome is reconciled one partition at a
+// time, from the runs of its windows. A failed window still counts as
+// finished, so that its chromosome leaves the memory budget; the chromosome
+// is then not filtered.
+static void runpass1(BGZF *fp, ChrJob &job, int w, TaskQueue *queue, bool filter) {
+	BamJob &bam=*job.bam;
+	if (! job.started.exchange(true)) {
+		cout << "Start chromosome " << chrlabel(job) << endl;
+	}
+	if (scanwindow(fp, job, w, filter)!=0) {
+		job.failed=true;
+	}
+	if (--job.pending>0) return;
+
+	bool cross=false;
+	if (job.failed || reconcilejob(job, filter, cross)!=0) {
+		job.failed=true;
+		bam.failed=true;
+		for (unique_ptr< Window > &other : job.windows) {
+			releasewindow(*other);
+			vector< bool >().swap(other->keep);
+			vector< uint8_t >().swap(other->classes);
+			vector< pair< uint32_t, uint64_t > >().swap(other->crossrecs);
+		}
+	}
+	for (unique_ptr< Window > &other : job.windows) {
+		other->runs.reset();
+	}
+	queue->release(job);
+	if (job.failed) return;
+	if (! filter) {
+		cout << "End chromosome " << chrlabel(job) << endl;
+		return;
+	}
+	job.pending=job.windows.size();
+	for (size_t k=0; k<job.windows.size(); k++) {
+		if (cross) {
+			queue->park(Task(&job, k, 2));
+		} else {
+			queue->push(Task(&job, k, 2));
+		}
+	}
+}
+
+// Write the classes of a window after its second scan, which numbers the bins
+static int writeclasses(Window &window) {
+	FILE *fp=fopen(window.classfile.c_str(), "wb");
+	bool ok=fp!=0 && fwrite(window.classes.data(), 1, window.classes.size(), fp)==window.classes.size();
+	if (fp!=0 && fclose(fp)!=0) {
+		ok=false;
+	}
+	vector< uint8_t >().swap(window.classes);
+	return ok ? 0 : 1;
+}
+
+// Second scan of a window into its file
+static int filterwindow(BGZF *fp, ChrJob &job, int w, TaskQueue *queue) {
+	BamJob &bam=*job.bam;
+	Window &window=*job.windows[w];
+	if (fp==0) return 1;
+	if (bam.sidecar.valid) {
+		if (bam.validready.valid()) {
+			bam.validready.wait();
+		}
+		uint64_t first, n;
+		bam.sidecar.range(job.tid, window, first, n);
+		if (bam.sidecar.readkeep(job.tid, first, n, bam.validpairs, window.keep)!=0) {
+			cerr << "Error: can not read " << bam.sidecar.filename << endl;
+			return 1;
+		}
+	}
+	resolvecrosskeep(bam, window);
+	string mode="wb";
+	if (opts.level>=0) {
+		mode+=to_string(opts.level);
+	}
+	if ((window.out=samopen(window.outfile.c_str(), mode.c_str(), bam.input.header))==0) {
+		cerr << "Error: can not write " << window.outfile << endl;
+		return 1;
+	}
+	// The blocks are the same as compressed by the worker alone
+	int borrowed=queue->borrow();
+	if (borrowed>0) {
+		samthreads(window.out, borrowed+1, COMPRESS_BLOCKS);
+	}
+	window.ordinal=0;
+	int result=bam_fetch(fp, bam.input.idx, job.tid, max(window.beg, 0), min(window.end, 1<<29), &window, filter_keep);
+	samclose(window.out);
+	window.out=0;
+	queue->lend(borrowed);
+	vector< bool >().swap(window.keep);
+	if (result<0) {
+		cerr << "Error: failed to filter region " << chrlabel(job) << endl;
+		return 1;
+	}
+	if (bam.keepclasses && writeclasses(window)!=0) {
+		cerr << "Error: can not write " << window.classfile << endl;
+		return 1;
+	}
+	return 0;
+}
+
+// 2. Second scan to filter false paired mapping. With a valid sidecar, the
+// decisions are read from it instead of the first scans. The worker
+// finishing the last window of a chromosome adds it to the checkpoint,
+// unless a window failed.
+static void runpass2(BGZF *fp, ChrJob &job, int w, TaskQueue *queue) {
+	BamJob &bam=*job.bam;
+	if (bam.sidecar.valid && ! job.started.exchange(true)) {
+		cout << "Start chromosome " << chrlabel(job) << endl;
+	}
+	if (filterwindow(fp, job, w, queue)!=0) {
+		job.failed=true;
+		bam.failed=true;
+	}
+	if (--job.pending>0 || job.failed) return;
+	if (bam.checkpoint.active() && bam.checkpoint.add(job)!=0) {
+		job.failed=true;
+		bam.failed=true;
+		return;
+	}
+	cout << "End chromosome " << chrlabel(job) << endl;
+}
+
+// A worker filtering with a block cache keeps the blocks of its last first
+// scan for the second scan of the same window; the second scans of other
+// windows bypass the cache, so that they do not evict them. A worker keeps
+// one file open, and opens another when a batch moves on to its windows.
+void chrworker(TaskQueue *queue, bool filter, int cachesize) {
+	BGZF *fp=0;
+	const BamJob *opened=0; // file of fp
+	if (! filter) {
+		cachesize=0;
+	}
+	Task task;
+	const Window *cached=0; // window of the blocks in the cache
+	while (queue->pop(task, cached)) {
+		BamJob &bam=*task.job->bam;
+		if (&bam!=opened) {
+			if (fp!=0) bgzf_close(fp);
+			// the records are fetched through the index, so the header is not read
+			fp=bgzf_open(bam.input.bamfile.c_str(), "r");
+			opened=&bam;
+			cached=0;
+			if (fp!=0 && opts.readthreads>0) {
+				bgzf_mt_read(fp, opts.readthreads, READAHEAD_BLOCKS);
+			}
+		}
+		// the task fails, and still counts as done for its chromosome
+		if (fp==0) {
+			cerr << "Error: not found " << bam.input.bamfile << endl;
+		}
+		const Window *window=task.job->windows[task.window].get();
+		if (task.pass==1) {
+			if (cachesize>0 && fp!=0) {
+				bgzf_clear_cache(fp);
+				bgzf_set_cache_size(fp, cachesize);
+				cached=window;
+			}
+			runpass1(fp, *task.job, task.window, queue, filter);
+			queue->firstdone();
+		} else {
+			if (fp!=0) {
+				bgzf_set_cache_size(fp, window==cached ? cachesize : 0);
+			}
+			runpass2(fp, *task.job, task.window, queue);
+			if (window==cached) {
+				bgzf_clear_cache(fp);
+				cached=0;
+			}
+		}
+		queue->done(task);
+	}
+	queue->lend(1);
+	if (fp!=0) bgzf_close(fp);
+}
+
+// Every worker may hold the dictionaries of a chromosome at a time. Those of
+// a chromosome exceeding the share of a worker are partitioned by read name,
+// so that one partition fits in the share.
+static void setpartitions(vector< unique_ptr< ChrJob > > &jobs, int64_t share, uint64_t perrecord) {
+	for (unique_ptr< ChrJob > &job : jobs) {
+		if (job->done) continue;
+		uint64_t records=0;
+		for (unique_ptr< Window > &window : job->windows) {
+			records+=window->size;
+		}
+		uint64_t n=(records*perrecord+share-1)/share;
+		if (n<=1) continue;
+		job->partitions=min< uint64_t >(n, MAX_PARTITIONS);
+		cout << "Spill chromosome " << chrlabel(*job) << " into " << job->partitions << " partitions" << endl;
+	}
+}
+
+// Run the windows of all chromosomes of the files on opts.numthreads
+// workers, less the threads reserved for compression, and sum up the tag
+// statistics of every file. Workers share no dictionary or
+// counter: every window has its own dictionary, and the counts of a
+// chromosome are only written by the worker reconciling it, so they are
+// reduced after the join without locking. The header and the index of the
+// input are only read.
+static int runchrjobs(vector< BamJob * > &bams, bool filter) {
+	TaskQueue queue;
+	vector< Task > tasks;
+	for (BamJob *bam : bams) {
+		bam->crosstable.clear();
+		bam->crosstable.verify=opts.verifyqname;
+		for (unique_ptr< ChrJob > &job : bam->jobs) {
+			if (! job->done) {
+				for (size_t w=0; w<job->windows.size(); w++) {
+					tasks.push_back(Task(job.get(), w, bam->sidecar.valid ? 2 : 1));
+				}
+				continue;
+			}
+			// the chromosomes left need the ends of a restored one
+			const char *qname=job->crossqnames.c_str();
+			for (TagRecord &rec : job->crosstags) {
+				bam->crosstable.add(rec.hash, qname, rec.flag, rec.zs, job->tid);
+				if (opts.verifyqname) {
+					qname+=strlen(qname)+1;
+				}
+			}
+			vector< TagRecord >().swap(job->crosstags);
+			string().swap(job->crossqnames);
+		}
+	}
+	queue.load(tasks);
+	size_t numwindows=tasks.size();
+
+	int numworkers=opts.numthreads;
+	if (filter) {
+		numworkers=max(1, opts.numthreads-opts.compressthreads);
+	}
+	numworkers=min< size_t >(numworkers, numwindows);
+	if (numworkers>0) {
+		int spare=max(0, opts.numthreads-numworkers);
+		queue.setspare(spare, max(1, (spare+numworkers-1)/numworkers));
+	}
+
+	uint64_t perrecord=DICT_BYTES_PER_RECORD+(opts.verifyqname ? QNAME_BYTES_PER_RECORD : 0);
+	for (BamJob *bam : bams) {
+		if (opts.maxmemory>0 && numworkers>0 && ! bam->sidecar.valid) {
+			setpartitions(bam->jobs, max< int64_t >(1, opts.maxmemory/numworkers), perrecord);
+		}
+	}
+	queue.setpipeline(numworkers, opts.maxmemory, perrecord);
+	int cachesize=0;
+	if (opts.blockcache>0 && numworkers>0) {
+		cachesize=min< int64_t >(opts.blockcache/numworkers, INT_MAX);
+	}
+	dictpool.setcapacity(numworkers);
+
+	vector<thread> threads;
+	for (int i=0; i<numworkers; i++) {
+		threads.push_back(thread(chrworker, &queue, filter, cachesize));
+	}
+	for (auto& th : threads) {
+		th.join();
+	}
+	dictpool.clear();
+
+	int ret=0;
+	for (BamJob *bam : bams) {
+		bam->crosstable.addtagstats(bam->jobs);
+		bam->crosstable.clear();
+		bam->tagstats.fill(0);
+		for (unique_ptr< ChrJob > &job : bam->jobs) {
+			for (int pair=0; pair<NUMTAGPAIRS; pair++) {
+				bam->tagstats[pair]+=job->tagstats[pair];
+			}
+		}
+		if (bam->failed) {
+			ret=1;
+		}
+	}
+	return ret;
+}
+
+// The chromosome files are disjoint and in header order, so their BGZF blocks
+// are spliced verbatim behind a single header
+int mergebam(vector< string > & files, string & outfile) {
+	vector< char * > fns;
+	for (string &infile: files) {
+		fns.push_back((char *)infile.c_str());
+	}
+	cout << "Concatenate " << files.size() << " chromosome files into " << (outfile=="-" ? "standard output" : outfile) << endl;
+	if (bam_cat(fns.size(), fns.data(), 0, outfile.c_str())!=0) {
+		cerr << "Error: failed to concatenate into " << outfile << endl;
+		return 1;
+	}
+	return 0;
+}
+
+int rmtmpfiles(vector< string > & files) {
+	int ret=0;
+	for (string &infile: files) {
+		if (remove(infile.c_str())!=0) {
+			cerr << "Error: can not remove " << infile << endl;
+			ret=1;
+		}
+	}
+	return ret;
+}
+
+static void reporttagstats(TagCounts &tagsresult, vector< unique_ptr< ChrJob > > &jobs, bool filter, bool pico) {
+	printtagstats(tagsresult);
+	if (opts.chrstats) {
+		printchrtagstats(jobs);
+	}
+
+	if (filter && opts.validtags.empty()) { // Positive rate is not meaningful for customized tags
+		uint64_t total=0;
+		uint64_t postivenumber=0;
+		calpostiverate(tagsresult, pico, total, postivenumber);
+		cout << "total reads: " << total << "; positive reads: " << postivenumber << endl;
+		if (total>0) {
+			double rate=1.0*postivenumber/total;
+			cout << "Positive rate: " << rate << endl;
+		}
+	}
+}
+
+// Sort order in the @HD line of the header, or empty
+static string sortorder(const bam_header_t *header) {
+	if (header->l_text<3 || strncmp(header->text, "@HD", 3)!=0) return "";
+	const char *end=strchr(header->text, '\n');
+	string hd(header->text, end ? end-header->text : header->l_text);
+	size_t so=hd.find("\tSO:");
+	if (so==string::npos) return "";
+	so+=4;
+	return hd.substr(so, hd.find('\t', so)-so);
+}
+
+// Input, output and statistics of the streaming modes
+class Stream {
+	public:
+		samfile_t *in;
+		samfile_t *out;
+		vector< unique_ptr< ChrJob > > jobs; // chromosome statistics only
+		vector< bam1_t * > head; // first records, read to estimate the library type
+		size_t h;
+		int r;
+		bool pico; // protocol, given or estimated
+	public:
+		Stream(): in(0), out(0), h(0), r(0), pico(opts.pico) { }
+		~Stream() {
+			for (bam1_t *b : head) {
+				bam_destroy1(b);
+			}
+			if (out!=0) samclose(out);
+			if (in!=0) samclose(in);
+		}
+};
+
+// The library type is estimated from the first records, which are kept for
+// filtering, since a pipe can not be read twice. Every record held counts
+// toward STREAM_LIBTYPE_RECORDS, secondary mappings included, and the test
+// ends as soon as it decides.
+static int openstream(Stream &stream, const string &infile, const string &outfile, bool estimate) {
+	if ((stream.in=openinput(infile))==0) {
+		return 1;
+	}
+	bam_header_t *header=stream.in->header;
+	for (int i=0; i<header->n_targets; i++) {
+		unique_ptr< ChrJob > job(new ChrJob());
+		job->chr=header->target_name[i];
+		job->tid=i;
+		stream.jobs.push_back(move(job));
+	}
+	if (estimate && opts.validtags.empty()) {
+		QnameDict read2tagtop; // qname->fragment
+		TagCounts tagstatstop{}; // tagpair->number
+		while (stream.head.size()<STREAM_LIBTYPE_RECORDS) {
+			bam1_t *b=bam_init1();
+			if ((stream.r=samread(stream.in, b))<0) {
+				bam_destroy1(b);
+				break;
+			}
+			stream.head.push_back(b);
+			if (! (b->core.flag & 0x100)) {
+				addtoptag(read2tagtop, b);
+			}
+			if (stream.head.size()%STREAM_LIBTYPE_CHECK==0) {
+				tagstatstop.fill(0);
+				addtagstats(read2tagtop, tagstatstop);
+				if (testlibtype(tagstatstop)>=0) break;
+			}
+		}
+		tagstatstop.fill(0);
+		addtagstats(read2tagtop, tagstatstop);
+		read2tagtop.clear();
+		stream.pico=decidelibtype(tagstatstop, "first "+to_string(stream.head.size())+" records");
+	} else if (estimate) {
+		cout << "Using customized PE tags" << endl;
+	}
+
+	if (! outfile.empty()) {
+		compilevalidtags(validpairs, stream.pico);
+		string mode="wb";
+		if (opts.level>=0) {
+			mode+=to_string(opts.level);
+		}
+		if ((stream.out=samopen(outfile.c_str(), mode.c_str(), header))==0) {
+			cerr << "Error: can not write " << outfile << endl;
+			return 1;
+		}
+		if (opts.numthreads>1) {
+			samthreads(stream.out, opts.numthreads, COMPRESS_BLOCKS);
+		}
+	}
+	return 0;
+}
+
+// Read the next record into b, the kept first records first; the buffer of b
+// may be exchanged
+static bool readstream(Stream &stream, bam1_t *&b) {
+	if (stream.h<stream.head.size()) {
+		swap(b, stream.head[stream.h++]);
+		return true;
+	}
+	if (stream.r<0) return false;
+	return (stream.r=samread(stream.in, b))>=0;
+}
+
+static int closestream(Stream &stream, const string &infile) {
+	int ret=0;
+	if (stream.r<-1) {
+		cerr << "Error: truncated file " << infile << endl;
+		ret=1;
+	}
+	bool filter=stream.out!=0;
+	if (filter) {
+		samclose(stream.out);
+		stream.out=0;
+	}
+
+	TagCounts tagsresult{};
+	for (unique_ptr< ChrJob > &job : stream.jobs) {
+		for (int pair=0; pair<NUMTAGPAIRS; pair++) {
+			tagsresult[pair]+=job->tagstats[pair];
+		}
+	}
+	reporttagstats(tagsresult, stream.jobs, filter, stream.pico);
+	return ret;
+}
+
+// Streaming mode for input grouped by read name. The records of a read name
+// are buffered, and every chromosome of them is a fragment as in the indexed
+// mode; the fragment's records are written right away if its tag pair is
+// valid. The chromosomes with mates on other chromosomes share one tag pair,
+// as the cross table gives them. Unplaced records are dropped, as the
+// indexed mode never fetches them.
+static void filtergroup(vector< bam1_t * > &group, size_t n, samfile_t *out, vector< unique_ptr< ChrJob > > &jobs) {
+	vector< pair< int32_t, uint8_t > > frags; // tid, tag pair
+	vector< bool > crossfrags;
+	CrossFrag cross={TAGPAIR_NONE, false, INT32_MAX, 0};
+	for (size_t i=0; i<n; i++) {
+		const bam1_t *b=group[i];
+		if (b->core.tid<0) continue;
+		size_t f=0;
+		while (f<frags.size() && frags[f].first!=b->core.tid) f++;
+		if (f==frags.size()) {
+			frags.push_back(make_pair(b->core.tid, (uint8_t)TAGPAIR_NONE));
+			crossfrags.push_back(false);
+		}
+		// Skip the multiple mapping @ 20191125
+		uint32_t flag=b->core.flag;
+		if (flag & 0x100) continue;
+		uint8_t zs=zscode(b);
+		frags[f].second=settagpair(frags[f].second, flag, zs);
+		if ((flag & 0x1) && b->core.mtid>=0 && b->core.mtid!=b->core.tid) {
+			crossfrags[f]=true;
+			cross.tags=settagpair(cross.tags, flag, zs);
+			if (! cross.first && ((flag & 0x40) || b->core.tid<cross.tid)) {
+				cross.first=(flag & 0x40)!=0;
+				cross.tid=b->core.tid;
+			}
+		}
+	}
+	for (size_t f=0; f<frags.size(); f++) {
+		if (crossfrags[f]) {
+			frags[f].second=cross.tags;
+		} else if (frags[f].second!=TAGPAIR_NONE) {
+			jobs[frags[f].first]->tagstats[frags[f].second]++;
+		}
+	}
+	if (cross.tags!=TAGPAIR_NONE) {
+		jobs[cross.tid]->tagstats[cross.tags]++;
+	}
+	if (out==0) return;
+	for (size_t i=0; i<n; i++) {
+		const bam1_t *b=group[i];
+		if (b->core.tid<0) continue;
+		size_t f=0;
+		while (frags[f].first!=b->core.tid) f++;
+		if (validpairs[frags[f].second]) {
+			samwrite(out, b);
+		}
+	}
+}
+
+static int pestream(string infile, string outfile, bool estimate) {
+	Stream stream;
+	if (openstream(stream, infile, outfile, estimate)!=0) {
+		return 1;
+	}
+	if (sortorder(stream.in->header)=="coordinate") {
+		cerr << "Error: " << infile << " is sorted by coordinate, but -n|--namesorted needs the records of a read name next to each other" << endl;
+		return 1;
+	}
+
+	vector< bam1_t * > group; // records of the current read name
+	size_t n=0;
+	for (;;) {
+		if (n==group.size()) {
+			group.push_back(bam_init1());
+		}
+		if (! readstream(stream, group[n])) break;
+		if (n>0 && strcmp(bam1_qname(group[n]), bam1_qname(group[0]))!=0) {
+			filtergroup(group, n, stream.out, stream.jobs);
+			swap(group[0], group[n]);
+			n=0;
+		}
+		n++;
+	}
+	filtergroup(group, n, stream.out, stream.jobs);
+	for (bam1_t *b : group) {
+		bam_destroy1(b);
+	}
+	return closestream(stream, infile);
+}
+
+// Write the records of the decided fragments at the front of the queue
+static void drainmates(MateBuffer &mates, samfile_t *out) {
+	while (mates.ready()) {
+		uint8_t tags;
+		const bam1_t *b=mates.front(tags);
+		if (out!=0 && validpairs[tags]) {
+			samwrite(out, b);
+		}
+		mates.pop();
+	}
+}
+
+// Decide the rest of a chromosome at its end
+static void flushmates(MateBuffer &mates, Stream &stream, int32_t tid) {
+	mates.evict(INT_MAX);
+	drainmates(mates, stream.out);
+	stream.jobs[tid]->tagstats=mates.tagstats;
+	mates.tagstats.fill(0);
+}
+
+// Streaming mode for input sorted by coordinate. A read is held until its
+// mate at mpos arrives, or until the scan passes mpos, when the missing end
+// is N; a mate farther than --matedistance is N at once. The records leave
+// in input order. Secondary mappings follow the
+// fragment while it waits for mates, and are dropped otherwise.
+static int pesortedstream(string infile, string outfile, bool estimate) {
+	Stream stream;
+	if (openstream(stream, infile, outfile, estimate)!=0) {
+		return 1;
+	}
+	string so=sortorder(stream.in->header);
+	if (! so.empty() && so!="coordinate") {
+		cerr << "Error: " << infile << " is sorted by " << so << ", but -C|--coordinatesorted needs coordinate order" << endl;
+		return 1;
+	}
+
+	MateBuffer mates(opts.matedistance);
+	int32_t tid=-1;
+	int32_t pos=-1;
+	bool sorted=true;
+	bool any=false; // a record has been read
+	bam1_t *b=bam_init1();
+	while (readstream(stream, b)) {
+		if (! any || b->core.tid!=tid) {
+			if (tid>=0) {
+				flushmates(mates, stream, tid);
+			}
+			// the unplaced reads, of tid -1, come last
+			if (any && (uint32_t)b->core.tid<(uint32_t)tid) {
+				sorted=false;
+				break;
+			}
+			any=true;
+			tid=b->core.tid;
+			pos=-1;
+		}
+		if (tid<0) continue; // unplaced reads are dropped, as the indexed mode never fetches them
+		if (b->core.pos<pos) {
+			sorted=false;
+			break;
+		}
+		pos=b->core.pos;
+		mates.evict(pos);
+		drainmates(mates, stream.out);
+		mates.push(b);
+		drainmates(mates, stream.out);
+	}
+	if (sorted && tid>=0) {
+		flushmates(mates, stream, tid);
+	}
+	bam_destroy1(b);
+	if (! sorted) {
+		cerr << "Error: " << infile << " is not sorted by coordinate" << endl;
+		closestream(stream, infile);
+		return 1;
+	}
+	return closestream(stream, infile);
+}
+
+// Bytes of a size with an optional K, M or G suffix; -1 if invalid
+int64_t parsememory(const string &size) {
+	char *end=0;
+	double n=strtod(size.c_str(), &end);
+	if (end==size.c_str() || n<0) return -1;
+	string suffix(end);
+	if (suffix=="K" || suffix=="k") {
+		n*=1<<10;
+	} else if (suffix=="M" || suffix=="m") {
+		n*=1<<20;
+	} else if (suffix=="G" || suffix=="g") {
+		n*=1<<30;
+	} else if (! suffix.empty()) {
+		return -1;
+	}
+	return (int64_t)n;
+}
+
+// Regions of APPROX_REGION bp sampled for the approximate statistics, and
+// the tag pairs of their fragments
+class ApproxSample {
+	public:
+		const BamInput *input;
+		vector< pair< int32_t, int32_t > > regions; // tid, start
+		vector< TagCounts > tagstats; // region->tag pair->number
+		atomic< size_t > next;
+		uint64_t length; // bp of the references
+		uint64_t sampled; // bp of the regions
+	public:
+		ApproxSample(const BamInput *input):
+			input(input)
+			, next(0)
+			, length(0)
+			, sampled(0) { }
+};
+
+// A region is sampled if the mixed bits of its number fall below the
+// fraction, so that the sample is the same for every run
+static void approxregions(ApproxSample &sample, double fraction) {
+	const bam_header_t *header=sample.input->header;
+	for (int i=0; i<header->n_targets; i++) {
+		uint32_t len=header->target_len[i];
+		sample.length+=len;
+		for (uint32_t beg=0; beg<len; beg+=APPROX_REGION) {
+			uint64_t h=(uint64_t)i<<32 | beg/APPROX_REGION;
+			h=hashqname((const char *)&h, sizeof(h));
+			if ((h>>11)*(1.0/(1ULL<<53))<fraction) {
+				sample.regions.push_back(make_pair(i, (int32_t)beg));
+				sample.sampled+=min< uint32_t >(APPROX_REGION, len-beg);
+			}
+		}
+	}
+	sample.tagstats.assign(sample.regions.size(), TagCounts{});
+}
+
+// A fragment belongs to the region of its leftmost primary end, or of the end
+// on the smaller tid; a mate at the same position registers it if first
+static bool leftmostend(const bam1_t *b) {
+	if (! (b->core.flag & 0x1) || b->core.mtid<0) return true;
+	if (b->core.mtid!=b->core.tid) return b->core.tid<b->core.mtid;
+	return b->core.mpos>=b->core.pos;
+}
+
+// Tag pairs of the fragments of a region. Mates to the right are read on up
+// to APPROX_EXTEND bp past the region, and farther mates or mates on other
+// chromosomes are fetched one by one, so that every fragment has both ends.
+static void approxregion(BGZF *fp, const BamInput &input, int32_t tid, int32_t beg, TagCounts &tagstats) {
+	int32_t end=beg+APPROX_REGION;
+	QnameDict read2tag; // qname->fragment
+	vector< pair< uint64_t, pair< int32_t, int32_t > > > far; // qname hash, mate tid and position
+	bam1_t *b=bam_init1();
+	bam_iter_t iter=bam_iter_query(input.idx, tid, beg, end+APPROX_EXTEND);
+	int32_t until=end; // end of the mates to read on for
+	while (bam_iter_read(fp, iter, b)>=0) {
+		if (b->core.pos<beg) continue; // overlapping from the left
+		if (b->core.pos>=until) break;
+		uint32_t flag=b->core.flag;
+		if (flag & 0x100) continue;
+		uint64_t hash=hashqname(bam1_qname(b), b->core.l_qname-1);
+		int64_t f=read2tag.find(0, hash);
+		if (f<0) {
+			if (b->core.pos>=end || ! leftmostend(b)) continue;
+			f=read2tag.get(bam1_qname(b), b->core.l_qname-1, hash);
+			if ((flag & 0x1) && b->core.mtid>=0 && b->core.mpos!=b->core.pos) {
+				if (b->core.mtid!=tid || b->core.mpos>=end+APPROX_EXTEND) {
+					far.push_back(make_pair(hash, make_pair(b->core.mtid, b->core.mpos)));
+				} else {
+					until=max(until, b->core.mpos+1);
+				}
+			}
+		}
+		read2tag.frags[f]=settagpair(read2tag.frags[f], flag, zscode(b));
+	}
+	bam_iter_destroy(iter);
+	for (pair< uint64_t, pair< int32_t, int32_t > > &mate : far) {
+		iter=bam_iter_query(input.idx, mate.second.first, mate.second.second, mate.second.second+1);
+		while (bam_iter_read(fp, iter, b)>=0) {
+			if (b->core.pos!=mate.second.second || (b->core.flag & 0x100)) continue;
+			if (hashqname(bam1_qname(b), b->core.l_qname-1)!=mate.first) continue;
+			int64_t f=read2tag.find(0, mate.first);
+			read2tag.frags[f]=settagpair(read2tag.frags[f], b->core.flag, zscode(b));
+			break;
+		}
+		bam_iter_destroy(iter);
+	}
+	bam_destroy1(b);
+	addtagstats(read2tag, tagstats);
+}
+
+static void approxworker(ApproxSample *sample) {
+	BGZF *fp=bgzf_open(sample->input->bamfile.c_str(), "r");
+	if (fp==0) {
+		cerr << "Error: not found " << sample->input->bamfile << endl;
+		failed=true;
+		return;
+	}
+	if (opts.readthreads>0) {
+		bgzf_mt_read(fp, opts.readthreads, READAHEAD_BLOCKS);
+	}
+	size_t k;
+	while ((k=sample->next++)<sample->regions.size()) {
+		approxregion(fp, *sample->input, sample->regions[k].first, sample->regions[k].second, sample->tagstats[k]);
+	}
+	bgzf_close(fp);
+}
+
+// Share of the fragments counted by ys among those counted by xs, with the
+// half width of its confidence interval. The regions are clusters of the
+// sample, so the variance is that of a ratio estimator over the regions,
+// corrected for the fraction f of the genome sampled.
+static double approxshare(const vector< uint64_t > &ys, const vector< uint64_t > &xs, double f, double &half) {
+	double y=0, x=0;
+	for (size_t r=0; r<xs.size(); r++) {
+		y+=ys[r];
+		x+=xs[r];
+	}
+	half=0;
+	if (x==0) return 0;
+	double share=y/x;
+	double m=xs.size();
+	if (m>1) {
+		double ss=0;
+		for (size_t r=0; r<xs.size(); r++) {
+			double d=ys[r]-share*xs[r];
+			ss+=d*d;
+		}
+		half=APPROX_Z*sqrt(max(0.0, 1-f)*m/(m-1)*ss)/x;
+	}
+	return share;
+}
+
+static string percent(double share) {
+	ostringstream out;
+	out.precision(3);
+	out << 100*share << "%";
+	return out.str();
+}
+
+// Statistics of -s estimated from a fraction of the genome, with the
+// numbers of the whole genome extrapolated from the sampled bp
+static int approxtagstats(const BamInput &input, double fraction) {
+	ApproxSample sample(&input);
+	approxregions(sample, fraction);
+	if (sample.regions.empty()) {
+		cerr << "Error: no region of " << APPROX_REGION << " bp is sampled at -a|--approximate " << fraction << endl;
+		return 1;
+	}
+	int n=max< size_t >(1, min< size_t >(opts.numthreads, sample.regions.size()));
+	vector< thread > threads;
+	for (int i=0; i<n; i++) {
+		threads.push_back(thread(approxworker, &sample));
+	}
+	for (thread &th : threads) {
+		th.join();
+	}
+
+	double scale=1.0*sample.length/sample.sampled;
+	size_t m=sample.regions.size();
+	vector< uint64_t > totals(m, 0);
+	vector< uint64_t > positives(m, 0);
+	const uint8_t *validtags=opts.pico ? validtags_pico : validtags_trad;
+	TagCounts tagsresult{};
+	for (size_t r=0; r<m; r++) {
+		for (int pair=0; pair<NUMTAGPAIRS; pair++) {
+			tagsresult[pair]+=sample.tagstats[r][pair];
+			totals[r]+=sample.tagstats[r][pair];
+			if (validtags[pair]) {
+				positives[r]+=sample.tagstats[r][pair];
+			}
+		}
+	}
+	cout << "Approximate number of PE tags from " << m << " regions, " << percent(1/scale) << " of the genome; share and 95% confidence interval:" << endl;
+	vector< uint64_t > counts(m);
+	for (int pair=0; pair<NUMTAGPAIRS; pair++) {
+		if (tagsresult[pair]==0) continue;
+		for (size_t r=0; r<m; r++) {
+			counts[r]=sample.tagstats[r][pair];
+		}
+		double half;
+		double share=approxshare(counts, totals, 1/scale, half);
+		cout << tagpairname(pair) << "\t" << (uint64_t)(tagsresult[pair]*scale+0.5) << "\t" << percent(share) << "\t" << percent(max(0.0, share-half)) << "-" << percent(min(1.0, share+half)) << endl;
+	}
+	uint64_t total=0;
+	uint64_t postivenumber=0;
+	calpostiverate(tagsresult, opts.pico, total, postivenumber);
+	cout << "total reads: " << (uint64_t)(total*scale+0.5) << "; positive reads: " << (uint64_t)(postivenumber*scale+0.5) << " (" << total << " sampled)" << endl;
+	if (total>0 && opts.validtags.empty()) {
+		double half;
+		double rate=approxshare(positives, totals, 1/scale, half);
+		cout << "Positive rate: " << rate << " (95% CI " << max(0.0, rate-half) << "-" << min(1.0, rate+half) << ")" << endl;
+	}
+	return failed ? 1 : 0;
+}
+
+// Load the header, the index and the chromosomes of an indexed BAM file
+static int loadbamjob(BamJob &bam, const string &bamfile, const string &outfile) {
+	bam.outfile=outfile;
+	bam.pico=opts.pico;
+	if (bam.input.load(bamfile)!=0 || loadchrjobs(bam.input, opts.windowsize, bam.jobs)!=0) {
+		return 1;
+	}
+	for (unique_ptr< ChrJob > &job : bam.jobs) {
+		job->bam=&bam;
+	}
+	return 0;
+}
+
+// A valid sidecar gives the statistics of every chromosome without a scan
+static void loadsidecarstats(BamJob &bam) {
+	if (! opts.sidecar || bam.sidecar.load(bam.input)!=0) return;
+	cout << "Read the statistics from " << bam.sidecar.filename << endl;
+	for (unique_ptr< ChrJob > &job : bam.jobs) {
+		job->tagstats=bam.sidecar.chrs[job->tid].tagstats;
+		job->done=true;
+	}
+}
+
+int petagstats(string bamfile)
+{
+	if (opts.namesorted) {
+		return pestream(bamfile, "", false);
+	}
+	if (opts.coordinatesorted) {
+		return pesortedstream(bamfile, "", false);
+	}
+	BamJob bam;
+	if (loadbamjob(bam, bamfile, "")!=0) {
+		return 1;
+	}
+	if (opts.approximate>0) {
+		return approxtagstats(bam.input, opts.approximate);
+	}
+	bam.tmpprefix=tmpprefix();
+	loadsidecarstats(bam);
+
+	vector< BamJob * > bams(1, &bam);
+	int ret=runchrjobs(bams, false);
+	reporttagstats(bam.tagstats, bam.jobs, false, bam.pico);
+	return ret;
+}
+
+// Input and decisions of a filtering run, which a checkpoint is only resumed
+// with. An estimated library type may differ between runs, so the key has the
+// protocol decided, once the estimate is done.
+static string runkey(BamJob &bam) {
+	struct stat st;
+	ostringstream key;
+	key << bam.input.bamfile;
+	if (stat(bam.input.bamfile.c_str(), &st)==0) {
+		key << " " << st.st_size << " " << st.st_mtime;
+	}
+	key << " windowsize " << opts.windowsize;
+	if (! opts.validtags.empty()) {
+		for (const string &tag : opts.validtags) {
+			key << " " << tag;
+		}
+	} else {
+		if (bam.validready.valid()) {
+			bam.validready.wait();
+		}
+		key << (bam.pico ? " pico" : " trad");
+	}
+	if (bam.sidecar.valid) {
+		key << " sidecar";
+	}
+	if (opts.verifyqname) {
+		key << " verifyqname";
+	}
+	return key.str();
+}
+
+// Decide the tag pairs of a file to filter, and name its window files. The
+// first scans need no decision, so the library type may be estimated while
+// they run.
+static int startfilter(BamJob &bam, bool estimate, bool overlap) {
+	BamJob *p=&bam;
+	if (estimate && overlap) {
+		// pico and validpairs are only read after validready
+		bam.validready=async(launch::async, [p] {
+				p->pico=estimatelibtype(p->input);
+				compilevalidtags(p->validpairs, p->pico);
+				}).share();
+	} else {
+		if (estimate) {
+			bam.pico=estimatelibtype(bam.input);
+		}
+		compilevalidtags(bam.validpairs, bam.pico);
+	}
+
+	// A valid sidecar replaces the first scans; otherwise the classes are
+	// recorded for a new one
+	if (opts.sidecar && bam.sidecar.load(bam.input)==0) {
+		cout << "Read the pair classes from " << bam.sidecar.filename << endl;
+		for (unique_ptr< ChrJob > &job : bam.jobs) {
+			job->tagstats=bam.sidecar.chrs[job->tid].tagstats;
+		}
+	} else {
+		bam.keepclasses=opts.sidecar;
+	}
+
+	// The files of standard output go to the temporary directory
+	string prefix=bam.outfile=="-" ? bam.tmpprefix : bam.outfile;
+	for (unique_ptr< ChrJob > &job : bam.jobs) {
+		for (size_t w=0; w<job->windows.size(); w++) {
+			Window &window=*job->windows[w];
+			window.outfile=prefix+"_"+job->chr;
+			if (job->windows.size()>1) {
+				window.outfile+="_"+to_string(w);
+			}
+			window.outfile+=".bam";
+			bam.tmpfiles.push_back(window.outfile);
+		}
+	}
+	if (opts.resume) {
+		if (bam.checkpoint.open(bam.outfile, runkey(bam), opts.verifyqname, bam.jobs)!=0) {
+			return 1;
+		}
+		// the classes of the restored chromosomes are gone
+		for (unique_ptr< ChrJob > &job : bam.jobs) {
+			if (job->done && bam.keepclasses) {
+				cout << "No sidecar is written by a resumed run" << endl;
+				bam.keepclasses=false;
+			}
+		}
+	}
+	for (unique_ptr< ChrJob > &job : bam.jobs) {
+		for (unique_ptr< Window > &window : job->windows) {
+			if (bam.keepclasses) {
+				window->classfile=window->outfile.substr(0, window->outfile.size()-4)+".pes";
+				bam.classfiles.push_back(window->classfile);
+			}
+		}
+	}
+	return 0;
+}
+
+// Merge the window files of a filtered file, write its sidecar, and report
+// its statistics
+static int finishfilter(BamJob &bam) {
+	int ret=bam.failed ? 1 : 0;
+	if (bam.validready.valid()) {
+		bam.validready.wait();
+		bam.validready=shared_future< void >();
+	}
+	if (ret==0 && mergebam(bam.tmpfiles, bam.outfile)!=0) {
+		ret=1;
+	}
+	// a failed run keeps its window files and manifest for --resume
+	if (ret==0) {
+		rmtmpfiles(bam.tmpfiles);
+		if (bam.checkpoint.active()) {
+			bam.checkpoint.remove(bam.jobs);
+		}
+	}
+	if (bam.keepclasses) {
+		if (ret==0 && bam.sidecar.write(bam.input, bam.jobs)==0) {
+			cout << "Write the pair classes into " << bam.sidecar.filename << endl;
+		}
+		rmtmpfiles(bam.classfiles);
+	}
+
+	reporttagstats(bam.tagstats, bam.jobs, true, bam.pico);
+	return ret;
+}
+
+int pefilter(string bamfile, string outfile, bool estimate)
+{
+	if (opts.namesorted) {
+		return pestream(bamfile, outfile, estimate);
+	}
+	if (opts.coordinatesorted) {
+		return pesortedstream(bamfile, outfile, estimate);
+	}
+	BamJob bam;
+	bam.tmpprefix=tmpprefix();
+	if (loadbamjob(bam, bamfile, outfile)!=0 || startfilter(bam, estimate, true)!=0) {
+		return 1;
+	}
+
+	vector< BamJob * > bams(1, &bam);
+	runchrjobs(bams, true);
+	return finishfilter(bam);
+}
+
+// Filter, or count with -s, the indexed BAM files of a sample sheet with one
+// pool of workers and one memory budget. Every line names an input file and,
+// unless -s, its output file, separated by white space; `#` starts a comment.
+// The windows of all files are queued together, so that the workers left
+// idle by the last chromosomes of a file take those of the others. The
+// library types are estimated one file after another before the scans.
+// A sheet that can not be read, a line without an output file, an input
+// that can not be opened with its index, or a manifest that can not be
+// written stops the batch before any scan. A file failing in its scans or
+// merge is reported, and the other files are still written; the return is
+// 1 if any file failed.
+int pebatch(string samplesheet, bool estimate)
+{
+	ifstream in(samplesheet);
+	if (! in) {
+		cerr << "Error: not found " << samplesheet << endl;
+		return 1;
+	}
+	vector< unique_ptr< BamJob > > bams;
+	string line;
+	while (getline(in, line)) {
+		istringstream fields(line.substr(0, line.find('#')));
+		string infile, outfile;
+		if (! (fields >> infile)) continue;
+		fields >> outfile;
+		if (! opts.statsonly && (outfile.empty() || outfile=="-")) {
+			cerr << "Error: no output file of " << infile << " in " << samplesheet << endl;
+			return 1;
+		}
+		unique_ptr< BamJob > bam(new BamJob());
+		bam->tmpprefix=tmpprefix()+"."+to_string(bams.size());
+		if (loadbamjob(*bam, infile, outfile)!=0) {
+			return 1;
+		}
+		bams.push_back(move(bam));
+	}
+	cout << "Batch of " << bams.size() << " files from " << samplesheet << endl;
+
+	vector< BamJob * > run;
+	for (unique_ptr< BamJob > &bam : bams) {
+		if (opts.statsonly) {
+			loadsidecarstats(*bam);
+		} else {
+			cout << "Prepare " << bam->input.bamfile << endl;
+			if (startfilter(*bam, estimate, false)!=0) {
+				return 1;
+			}
+		}
+		run.push_back(bam.get());
+	}
+	int ret=runchrjobs(run, ! opts.statsonly);
+	for (unique_ptr< BamJob > &bam : bams) {
+		cout << "Result of " << bam->input.bamfile << endl;
+		if (opts.statsonly) {
+			reporttagstats(bam->tagstats, bam->jobs, false, bam->pico);
+		} else if (finishfilter(*bam)!=0) {
+			ret=1;
+		}
+	}
+	return ret;
+}
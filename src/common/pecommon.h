@@ -0,0 +1,97 @@
+#ifndef PECOMMON_H
+#define PECOMMON_H
+
+#include <iostream>
+#include <string>
+#include <set>
+#include <map>
+#include "tagcode.h"
+
+using namespace std;
+
+class Opts {
+	public:
+		string infile;
+		string outfile;
+		string batch;
+		bool pico;
+		bool statsonly;
+		int numthreads;
+		int readthreads;
+		int compressthreads;
+		int level;
+		int64_t windowsize;
+		int64_t maxmemory;
+		int64_t blockcache;
+		double approximate;
+		bool sidecar;
+		bool resume;
+		bool verifyqname;
+		bool chrstats;
+		bool namesorted;
+		bool coordinatesorted;
+		int matedistance;
+		bool saminput;
+		set< string > validtags;
+	public:
+		Opts():
+			infile("")
+			, outfile("")
+			, batch("")
+			, pico(false)
+			, statsonly(false)
+			, numthreads(1)
+			, readthreads(0)
+			, compressthreads(0)
+			, level(-1)
+			, windowsize(50000000)
+			, maxmemory(0)
+			, blockcache(0)
+			, approximate(0)
+			, sidecar(false)
+			, resume(false)
+			, verifyqname(false)
+			, chrstats(false)
+			, namesorted(false)
+			, coordinatesorted(false)
+			, matedistance(1000000)
+			, saminput(false) { }
+	public:
+		void out() {
+			cout << "infile: " << infile << endl;
+			cout << "outfile: " << outfile << endl;
+			cout << "batch: " << batch << endl;
+			cout << "pico: " << std::boolalpha << pico << endl;
+			cout << "statsonly: " << std::boolalpha << statsonly << endl;
+			cout << "numthreads: " << numthreads << endl;
+			cout << "readthreads: " << readthreads << endl;
+			cout << "compressthreads: " << compressthreads << endl;
+			cout << "level: " << level << endl;
+			cout << "windowsize: " << windowsize << endl;
+			cout << "maxmemory: " << maxmemory << endl;
+			cout << "blockcache: " << blockcache << endl;
+			cout << "approximate: " << approximate << endl;
+			cout << "sidecar: " << std::boolalpha << sidecar << endl;
+			cout << "resume: " << std::boolalpha << resume << endl;
+			cout << "verifyqname: " << std::boolalpha << verifyqname << endl;
+			cout << "chrstats: " << std::boolalpha << chrstats << endl;
+			cout << "namesorted: " << std::boolalpha << namesorted << endl;
+			cout << "coordinatesorted: " << std::boolalpha << coordinatesorted << endl;
+			cout << "matedistance: " << matedistance << endl;
+			cout << "saminput: " << std::boolalpha << saminput << endl;
+			cout << "validtags:";
+			for (string tag: validtags) {
+				cout << " " << tag;
+			}
+			cout << endl;
+		}
+};
+extern Opts opts;
+
+int petagstats(string bamfile);
+void calpostiverate(TagCounts & tagstats, bool pico, uint64_t & total, uint64_t & postivenumber);
+int pefilter(string bamfile, string outfile, bool estimate);
+int pebatch(string samplesheet, bool estimate);
+int64_t parsememory(const string &size);
+
+#endif
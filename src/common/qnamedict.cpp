@@ -0,0 +1,119 @@
+#include <cstring>
+#include "qnamedict.h"
+
+// Most fragments have both ends on the chromosome, so half of the records is
+// a good guess of the number of fragments.
+void QnameDict::reserve(uint64_t nrecords) {
+	uint64_t n=nrecords/2+1;
+	if (n>0x7fffffffULL) n=0x7fffffffULL;
+	// a reused table is never shrunk
+	khint_t buckets=(khint_t)(n/0.77+1);
+	if (kh_n_buckets(h)<buckets) {
+		kh_resize(qname2frag, h, buckets);
+	}
+	frags.reserve(n);
+}
+
+// Find the fragment of a read name, or insert a new one
+uint32_t QnameDict::get(const char *qname, size_t len, uint64_t hash) {
+	uint64_t key=hash;
+	for (;;) {
+		int ret;
+		khint_t k=kh_put(qname2frag, h, key, &ret);
+		if (ret) {
+			kh_val(h, k)=frags.size();
+			frags.push_back(TAGPAIR_NONE);
+			if (verify) {
+				qnameoffs.push_back(qnames.size());
+				qnames.append(qname, len);
+				qnames.push_back('\0');
+			}
+			return kh_val(h, k);
+		}
+		uint32_t i=kh_val(h, k);
+		if (!verify || 0==strcmp(getqname(i), qname)) {
+			return i;
+		}
+		// different read name of the same hash, probe the next key
+		key=key*0x9e3779b97f4a7c15ULL+1;
+	}
+}
+
+// Find the fragment of a read name; return -1 if not found. The read name is
+// only compared in verify mode and may be NULL otherwise.
+int64_t QnameDict::find(const char *qname, uint64_t hash) const {
+	uint64_t key=hash;
+	for (;;) {
+		khint_t k=kh_get(qname2frag, h, key);
+		if (k==kh_end(h)) {
+			return -1;
+		}
+		uint32_t i=kh_val(h, k);
+		if (!verify || 0==strcmp(getqname(i), qname)) {
+			return i;
+		}
+		key=key*0x9e3779b97f4a7c15ULL+1;
+	}
+}
+
+void QnameDict::clear() {
+	kh_destroy(qname2frag, h);
+	h=kh_init(qname2frag);
+	vector< uint8_t >().swap(frags);
+	vector< uint64_t >().swap(qnameoffs);
+	string().swap(qnames);
+}
+
+// Empty the dictionary, keeping its storage
+void QnameDict::reset() {
+	kh_clear(qname2frag, h);
+	frags.clear();
+	qnameoffs.clear();
+	qnames.clear();
+}
+
+// Exchange the storage, but not the mode, of two dictionaries
+void QnameDict::swap(QnameDict &other) {
+	std::swap(h, other.h);
+	frags.swap(other.frags);
+	qnameoffs.swap(other.qnameoffs);
+	qnames.swap(other.qnames);
+}
+
+void QnameDictPool::setcapacity(size_t n) {
+	lock_guard< mutex > lock(m);
+	capacity=n;
+	if (dicts.size()>capacity) {
+		dicts.resize(capacity);
+	}
+}
+
+// Give the storage of a kept dictionary to an empty one, if any is kept
+void QnameDictPool::take(QnameDict &dict) {
+	unique_ptr< QnameDict > kept;
+	{
+		lock_guard< mutex > lock(m);
+		if (dicts.empty()) return;
+		kept=move(dicts.back());
+		dicts.pop_back();
+	}
+	dict.swap(*kept);
+}
+
+// Empty a dictionary, and keep its storage if the pool is not full
+void QnameDictPool::give(QnameDict &dict) {
+	unique_ptr< QnameDict > kept(new QnameDict());
+	kept->swap(dict);
+	kept->reset();
+	{
+		lock_guard< mutex > lock(m);
+		if (dicts.size()<capacity) {
+			dicts.push_back(move(kept));
+		}
+	}
+}
+
+void QnameDictPool::clear() {
+	lock_guard< mutex > lock(m);
+	dicts.clear();
+}
@@ -0,0 +1,99 @@
+#ifndef QNAMEDICT_H
+#define QNAMEDICT_H
+
+#include <stdint.h>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include "khash.h"
+#include "tagcode.h"
+
+using namespace std;
+
+// 64-bit hash of a read name -> index in QnameDict::frags
+KHASH_MAP_INIT_INT64(qname2frag, uint32_t)
+
+// MurmurHash64A of a read name
+static inline uint64_t hashqname(const char *s, size_t len) {
+	const uint64_t m=0xc6a4a7935bd1e995ULL;
+	const int r=47;
+	uint64_t h=0x8445d61a4e774912ULL^(len*m);
+	const unsigned char *p=(const unsigned char *)s;
+	const unsigned char *end=p+(len/8)*8;
+	for (; p!=end; p+=8) {
+		uint64_t k;
+		memcpy(&k, p, 8);
+		k*=m; k^=k>>r; k*=m;
+		h^=k; h*=m;
+	}
+	switch (len&7) {
+		case 7: h^=uint64_t(p[6])<<48;
+			// fallthrough
+		case 6: h^=uint64_t(p[5])<<40;
+			// fallthrough
+		case 5: h^=uint64_t(p[4])<<32;
+			// fallthrough
+		case 4: h^=uint64_t(p[3])<<24;
+			// fallthrough
+		case 3: h^=uint64_t(p[2])<<16;
+			// fallthrough
+		case 2: h^=uint64_t(p[1])<<8;
+			// fallthrough
+		case 1: h^=uint64_t(p[0]);
+			h*=m;
+	}
+	h^=h>>r; h*=m; h^=h>>r;
+	return h;
+}
+
+// Flat open-addressing dictionary of the fragments of one chromosome, keyed
+// by the 64-bit hash of the read name. In verify mode the read names are kept
+// and compared on every hit, and colliding names probe successive keys.
+class QnameDict {
+	public:
+		bool verify;
+		vector< uint8_t > frags; // fragment->tag pair
+		vector< uint64_t > qnameoffs; // fragment->offset in qnames, verify mode only
+		string qnames; // NUL terminated read names, verify mode only
+	private:
+		khash_t(qname2frag) *h;
+	public:
+		QnameDict():
+			verify(false)
+			, h(kh_init(qname2frag)) { }
+		~QnameDict() { kh_destroy(qname2frag, h); }
+		QnameDict(const QnameDict &)=delete;
+		QnameDict &operator=(const QnameDict &)=delete;
+	public:
+		void reserve(uint64_t nrecords);
+		uint32_t get(const char *qname, size_t len) { return get(qname, len, hashqname(qname, len)); }
+		uint32_t get(const char *qname, size_t len, uint64_t hash);
+		int64_t find(const char *qname, uint64_t hash) const;
+		const char *getqname(uint32_t i) const { return qnames.c_str()+qnameoffs[i]; }
+		void clear();
+		void reset();
+		void swap(QnameDict &other);
+};
+
+// Emptied dictionaries kept for the next windows, so that their hash tables
+// and read name bytes are reused instead of freed and faulted in again for
+// every chromosome. At most capacity dictionaries are kept.
+class QnameDictPool {
+	private:
+		vector< unique_ptr< QnameDict > > dicts;
+		size_t capacity;
+		mutex m;
+	public:
+		QnameDictPool(): capacity(0) { }
+		QnameDictPool(const QnameDictPool &)=delete;
+		QnameDictPool &operator=(const QnameDictPool &)=delete;
+	public:
+		void setcapacity(size_t n);
+		void take(QnameDict &dict);
+		void give(QnameDict &dict);
+		void clear();
+};
+
+#endif
@@ -0,0 +1,241 @@
+#include <iostream>
+#include <cstdio>
+#include <cstring>
+#include <climits>
+#include <sys/stat.h>
+#include "sidecar.h"
+#include "qnamedict.h"
+
+static const char SIDECAR_MAGIC[4]={'P', 'E', 'S', '\1'};
+// Classes of 8 records are packed into 5 bytes
+#define GROUP_RECORDS 8
+#define GROUP_BYTES 5
+// Groups read or written at a time
+#define IO_GROUPS 4096
+
+// Size and modification time of the BAM file, and hash of its header
+int Sidecar::stamp(const BamInput &input) {
+	struct stat st;
+	if (stat(input.bamfile.c_str(), &st)!=0) {
+		return 1;
+	}
+	bamsize=st.st_size;
+	bammtime=st.st_mtime;
+	const bam_header_t *header=input.header;
+	string text(header->text, header->l_text);
+	for (int i=0; i<header->n_targets; i++) {
+		text+=string(header->target_name[i])+'\t'+to_string(header->target_len[i])+'\n';
+	}
+	headerhash=hashqname(text.c_str(), text.size());
+	return 0;
+}
+
+static uint64_t groupbytes(uint64_t records) {
+	return (records+GROUP_RECORDS-1)/GROUP_RECORDS*GROUP_BYTES;
+}
+
+// Load the directory of <bam>.pes if it matches the input. A missing sidecar
+// is no error; a stale one is reported and not used.
+int Sidecar::load(const BamInput &input) {
+	valid=false;
+	filename=input.bamfile+".pes";
+	FILE *fp=fopen(filename.c_str(), "rb");
+	if (fp==0) {
+		return 1;
+	}
+	Sidecar current;
+	char magic[4];
+	int32_t n=0;
+	bool ok=current.stamp(input)==0
+		&& fread(magic, 1, 4, fp)==4 && memcmp(magic, SIDECAR_MAGIC, 4)==0
+		&& fread(&bamsize, sizeof(bamsize), 1, fp)==1
+		&& fread(&bammtime, sizeof(bammtime), 1, fp)==1
+		&& fread(&headerhash, sizeof(headerhash), 1, fp)==1
+		&& fread(&n, sizeof(n), 1, fp)==1
+		&& bamsize==current.bamsize && bammtime==current.bammtime && headerhash==current.headerhash
+		&& n==input.header->n_targets;
+	chrs.assign(ok ? n : 0, SidecarChr());
+	for (SidecarChr &chr : chrs) {
+		uint32_t nbins=0;
+		ok=ok && fread(&chr.records, sizeof(chr.records), 1, fp)==1
+			&& fread(chr.tagstats.data(), sizeof(uint64_t), NUMTAGPAIRS, fp)==NUMTAGPAIRS
+			&& fread(&nbins, sizeof(nbins), 1, fp)==1;
+		if (! ok) break;
+		chr.bins.resize(nbins);
+		ok=fread(chr.bins.data(), sizeof(uint64_t), nbins, fp)==nbins;
+	}
+	if (ok) {
+		int64_t offset=ftell(fp);
+		for (SidecarChr &chr : chrs) {
+			chr.offset=offset;
+			offset+=groupbytes(chr.records);
+		}
+		// a sidecar cut short is stale as well
+		ok=fseek(fp, 0, SEEK_END)==0 && ftell(fp)==offset;
+	}
+	fclose(fp);
+	if (! ok) {
+		chrs.clear();
+		cout << "Sidecar " << filename << " does not match " << input.bamfile << "; not used" << endl;
+		return 1;
+	}
+	valid=true;
+	return 0;
+}
+
+static int putgroups(FILE *fp, const uint8_t *classes, size_t n) {
+	unsigned char buf[IO_GROUPS*GROUP_BYTES];
+	size_t len=0;
+	for (size_t i=0; i<n; i+=GROUP_RECORDS) {
+		uint64_t v=0;
+		for (int k=0; k<GROUP_RECORDS && i+k<n; k++) {
+			uint8_t c=classes[i+k]<NUMTAGPAIRS ? classes[i+k] : SIDECAR_NONE;
+			v|=(uint64_t)c<<(5*k);
+		}
+		for (int k=0; k<GROUP_BYTES; k++) {
+			buf[len++]=v>>(8*k);
+		}
+		if (len==sizeof(buf)) {
+			if (fwrite(buf, 1, len, fp)!=len) return 1;
+			len=0;
+		}
+	}
+	return fwrite(buf, 1, len, fp)==len ? 0 : 1;
+}
+
+// Write <bam>.pes from the class files of the windows of a filtering run,
+// through a temporary file, so that an interrupted run leaves no sidecar
+int Sidecar::write(const BamInput &input, const vector< unique_ptr< ChrJob > > &jobs) {
+	valid=false;
+	filename=input.bamfile+".pes";
+	if (stamp(input)!=0) {
+		cerr << "Error: not found " << input.bamfile << endl;
+		return 1;
+	}
+	chrs.assign(jobs.size(), SidecarChr());
+	for (const unique_ptr< ChrJob > &job : jobs) {
+		SidecarChr &chr=chrs[job->tid];
+		chr.tagstats=job->tagstats;
+		chr.bins.assign(input.header->target_len[job->tid]/WINDOW_ALIGN+1, 0);
+		for (size_t w=0; w<job->windows.size(); w++) {
+			const Window &window=*job->windows[w];
+			size_t firstbin=max(window.beg, 0)/WINDOW_ALIGN;
+			size_t endbin=w==job->windows.size()-1 ? chr.bins.size() : window.end/WINDOW_ALIGN;
+			for (size_t j=firstbin; j<endbin; j++) {
+				chr.bins[j]=chr.records+(j-firstbin<window.bins.size() ? window.bins[j-firstbin] : window.numrecords);
+			}
+			chr.records+=window.numrecords;
+		}
+		// the bins past the last record are implied
+		while (! chr.bins.empty() && chr.bins.back()==chr.records) {
+			chr.bins.pop_back();
+		}
+	}
+
+	string tmpfile=filename+".tmp";
+	FILE *fp=fopen(tmpfile.c_str(), "wb");
+	if (fp==0) {
+		cerr << "Error: can not write " << tmpfile << endl;
+		return 1;
+	}
+	int32_t n=chrs.size();
+	fwrite(SIDECAR_MAGIC, 1, 4, fp);
+	fwrite(&bamsize, sizeof(bamsize), 1, fp);
+	fwrite(&bammtime, sizeof(bammtime), 1, fp);
+	fwrite(&headerhash, sizeof(headerhash), 1, fp);
+	fwrite(&n, sizeof(n), 1, fp);
+	for (SidecarChr &chr : chrs) {
+		uint32_t nbins=chr.bins.size();
+		fwrite(&chr.records, sizeof(chr.records), 1, fp);
+		fwrite(chr.tagstats.data(), sizeof(uint64_t), NUMTAGPAIRS, fp);
+		fwrite(&nbins, sizeof(nbins), 1, fp);
+		fwrite(chr.bins.data(), sizeof(uint64_t), nbins, fp);
+	}
+	// The classes of a chromosome are read from its windows in order, and
+	// packed from the first group of the chromosome
+	int ret=0;
+	vector< uint8_t > classes;
+	for (const unique_ptr< ChrJob > &job : jobs) {
+		classes.clear();
+		for (const unique_ptr< Window > &window : job->windows) {
+			FILE *in=fopen(window->classfile.c_str(), "rb");
+			size_t size=classes.size();
+			classes.resize(size+window->numrecords);
+			if (in==0 || fread(classes.data()+size, 1, window->numrecords, in)!=window->numrecords) {
+				cerr << "Error: can not read " << window->classfile << endl;
+				ret=1;
+			}
+			if (in!=0) fclose(in);
+			// flush whole groups, so that a chromosome needs no more memory than its windows
+			size_t whole=classes.size()/(IO_GROUPS*GROUP_RECORDS)*(IO_GROUPS*GROUP_RECORDS);
+			if (ret==0 && whole>0) {
+				ret=putgroups(fp, classes.data(), whole);
+				classes.erase(classes.begin(), classes.begin()+whole);
+			}
+			if (ret!=0) break;
+		}
+		if (ret==0) {
+			ret=putgroups(fp, classes.data(), classes.size());
+		}
+		if (ret!=0) break;
+	}
+	if (fclose(fp)!=0 || ret!=0) {
+		cerr << "Error: can not write " << tmpfile << endl;
+		remove(tmpfile.c_str());
+		return 1;
+	}
+	if (rename(tmpfile.c_str(), filename.c_str())!=0) {
+		cerr << "Error: can not write " << filename << endl;
+		remove(tmpfile.c_str());
+		return 1;
+	}
+	valid=true;
+	return 0;
+}
+
+static uint64_t binordinal(const SidecarChr &chr, int pos) {
+	size_t bin=pos/WINDOW_ALIGN;
+	return bin<chr.bins.size() ? chr.bins[bin] : chr.records;
+}
+
+// Ordinals in the chromosome of the records of a window
+void Sidecar::range(int tid, const Window &window, uint64_t &first, uint64_t &n) const {
+	const SidecarChr &chr=chrs[tid];
+	first=window.beg<=0 ? 0 : binordinal(chr, window.beg);
+	uint64_t last=window.end==INT_MAX ? chr.records : binordinal(chr, window.end);
+	n=last-first;
+}
+
+// Decisions of n records from ordinal first of a chromosome under validpairs
+int Sidecar::readkeep(int tid, uint64_t first, uint64_t n, const uint8_t *validpairs, vector< bool > &keep) const {
+	keep.assign(n, false);
+	if (n==0) return 0;
+	FILE *fp=fopen(filename.c_str(), "rb");
+	if (fp==0 || fseek(fp, chrs[tid].offset+first/GROUP_RECORDS*GROUP_BYTES, SEEK_SET)!=0) {
+		if (fp!=0) fclose(fp);
+		return 1;
+	}
+	unsigned char buf[IO_GROUPS*GROUP_BYTES];
+	size_t skip=first%GROUP_RECORDS;
+	uint64_t i=0;
+	while (i<n) {
+		size_t groups=min< uint64_t >(IO_GROUPS, (skip+n-i+GROUP_RECORDS-1)/GROUP_RECORDS);
+		if (fread(buf, GROUP_BYTES, groups, fp)!=groups) {
+			fclose(fp);
+			return 1;
+		}
+		for (size_t g=0; g<groups; g++) {
+			uint64_t v=0;
+			for (int k=0; k<GROUP_BYTES; k++) {
+				v|=(uint64_t)buf[g*GROUP_BYTES+k]<<(8*k);
+			}
+			for (size_t k=skip; k<GROUP_RECORDS && i<n; k++, i++) {
+				uint8_t c=(v>>(5*k)) & 0x1f;
+				keep[i]=c<NUMTAGPAIRS && validpairs[c];
+			}
+			skip=0;
+		}
+	}
+	fclose(fp);
+	return 0;
+}
@@ -0,0 +1,59 @@
+#ifndef SIDECAR_H
+#define SIDECAR_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <memory>
+#include "tagcode.h"
+#include "chrjob.h"
+
+using namespace std;
+
+// Class of a record whose fragment has no primary pair, e.g. TAGPAIR_NONE
+#define SIDECAR_NONE 0x1f
+
+// Directory of a chromosome in a sidecar
+class SidecarChr {
+	public:
+		uint64_t records;
+		TagCounts tagstats{}; // tagpair->number
+		vector< uint64_t > bins; // ordinal of the first record at or after every WINDOW_ALIGN bp, up to the last record
+		int64_t offset; // of the classes in the file
+	public:
+		SidecarChr():
+			records(0)
+			, offset(0) { }
+};
+
+// Pair classes of an indexed BAM file, kept next to it in <bam>.pes by a
+// filtering run: the tag statistics of every chromosome, and the tag pair of
+// the fragment of every record, 5 bits each, in fetch order. The statistics
+// and the decisions of any tag set are read from it without the read name
+// dictionaries. It only serves a BAM file of the same size, modification time
+// and header. Since the windows are aligned to WINDOW_ALIGN, the ordinals of a
+// window of any size are found from the bins.
+class Sidecar {
+	public:
+		string filename;
+		bool valid; // loaded and matching the input
+		uint64_t bamsize;
+		int64_t bammtime;
+		uint64_t headerhash;
+		vector< SidecarChr > chrs;
+	private:
+		int stamp(const BamInput &input);
+	public:
+		Sidecar():
+			valid(false)
+			, bamsize(0)
+			, bammtime(0)
+			, headerhash(0) { }
+	public:
+		int load(const BamInput &input);
+		int write(const BamInput &input, const vector< unique_ptr< ChrJob > > &jobs);
+		void range(int tid, const Window &window, uint64_t &first, uint64_t &n) const;
+		int readkeep(int tid, uint64_t first, uint64_t n, const uint8_t *validpairs, vector< bool > &keep) const;
+};
+
+#endif
@@ -0,0 +1,96 @@
+#include <algorithm>
+#include "spillruns.h"
+
+SpillRuns::~SpillRuns() {
+	for (size_t f=0; f<names.size(); f++) {
+		if (files[f]!=0) fclose(files[f]);
+		if (created[f]) ::remove(names[f].c_str());
+	}
+}
+
+// Name the files prefix.<f>.run of n partitions, at most nfiles of them. File
+// f keeps the partitions f, f+nfiles, ..., so that a small window needs few
+// files; it is only created by its first record.
+void SpillRuns::open(const string &prefix, int n, int nfiles, bool verify) {
+	this->verify=verify;
+	partitions=n;
+	nfiles=max(1, min(n, nfiles));
+	for (int f=0; f<nfiles; f++) {
+		names.push_back(prefix+"."+to_string(f)+".run");
+		files.push_back(0);
+		created.push_back(false);
+	}
+}
+
+// Write errors are reported by close()
+void SpillRuns::write(const TagRecord &rec, const char *qname, size_t len) {
+	size_t f=partition(rec)%files.size();
+	if (files[f]==0) {
+		if (failed || created[f]) return;
+		if ((files[f]=fopen(names[f].c_str(), "wb"))==0) {
+			failed=true;
+			return;
+		}
+		created[f]=true;
+	}
+	FILE *fp=files[f];
+	fwrite(&rec, sizeof(rec), 1, fp);
+	if (verify) {
+		uint8_t l=len;
+		fwrite(&l, 1, 1, fp);
+		fwrite(qname, 1, l, fp);
+	}
+}
+
+// Close the files after the scan, which keeps those written open
+int SpillRuns::close() {
+	int ret=failed ? 1 : 0;
+	for (FILE *&fp : files) {
+		if (fp==0) continue;
+		if (ferror(fp) || fclose(fp)!=0) ret=1;
+		fp=0;
+	}
+	return ret;
+}
+
+// Open the file of partition p for reading; a file never created is empty
+int SpillRuns::start(int p) {
+	size_t f=p%files.size();
+	if (! created[f]) return 0;
+	files[f]=fopen(names[f].c_str(), "rb");
+	return files[f]==0 ? 1 : 0;
+}
+
+// Next record of partition p, skipping those of the other partitions of its
+// file; qname has room for 256 bytes and is NUL terminated in verify mode.
+// Return 1 for a record, 0 at the end and -1 on a truncated file.
+int SpillRuns::next(int p, TagRecord &rec, char *qname, size_t &len) {
+	FILE *fp=files[p%files.size()];
+	if (fp==0) return 0;
+	for (;;) {
+		size_t n=fread(&rec, 1, sizeof(rec), fp);
+		if (n==0 && feof(fp)) return 0;
+		if (n!=sizeof(rec)) return -1;
+		len=0;
+		if (verify) {
+			uint8_t l;
+			if (fread(&l, 1, 1, fp)!=1 || fread(qname, 1, l, fp)!=l) return -1;
+			len=l;
+			qname[len]='\0';
+		}
+		if (partition(rec)==p) return 1;
+	}
+}
+
+// Close the file of partition p, and delete it after its last partition
+void SpillRuns::remove(int p) {
+	size_t f=p%files.size();
+	if (files[f]!=0) {
+		fclose(files[f]);
+		files[f]=0;
+	}
+	if (p+files.size()>=(size_t)partitions && created[f]) {
+		::remove(names[f].c_str());
+		created[f]=false;
+	}
+}
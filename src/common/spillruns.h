@@ -0,0 +1,59 @@
+#ifndef SPILLRUNS_H
+#define SPILLRUNS_H
+
+#include <stdint.h>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Bits of TagRecord::bits
+#define TAGREC_BOUNDARY 0x1 // the mate is mapped to the chromosome outside the window
+#define TAGREC_CROSS 0x2 // the mate is mapped to another chromosome
+
+// What the first scan needs of a record of a window
+class TagRecord {
+	public:
+		uint64_t hash; // of the read name
+		uint32_t ordinal;
+		uint16_t flag;
+		uint8_t zs;
+		uint8_t bits; // TAGREC_* bits
+};
+
+// First scan of a window partitioned by read name hash into files, like
+// samtools bamshuf does, so that the tag dictionary of one partition at a
+// time is in memory. The files are written in fetch order, closed, and read
+// back one after another; in verify mode every record is followed by its
+// name. The files are removed once read, and by the destructor after an
+// error.
+class SpillRuns {
+	private:
+		vector< FILE * > files;
+		vector< string > names;
+		vector< bool > created;
+		int partitions;
+		bool verify;
+		bool failed; // a file could not be created
+	private:
+		int partition(const TagRecord &rec) const { return (rec.hash>>32)%partitions; }
+	public:
+		SpillRuns():
+			partitions(1)
+			, verify(false)
+			, failed(false) { }
+		~SpillRuns();
+		SpillRuns(const SpillRuns &)=delete;
+		SpillRuns &operator=(const SpillRuns &)=delete;
+	public:
+		void open(const string &prefix, int n, int nfiles, bool verify);
+		void write(const TagRecord &rec, const char *qname, size_t len);
+		int close();
+		int start(int p);
+		int next(int p, TagRecord &rec, char *qname, size_t &len);
+		void remove(int p);
+		const string &name(int p) const { return names[p%names.size()]; }
+};
+
+#endif
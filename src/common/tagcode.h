@@ -0,0 +1,156 @@
+#ifndef TAGCODE_H
+#define TAGCODE_H
+
+#include <stdint.h>
+#include <cstring>
+#include <string>
+#include <array>
+#include "sam.h"
+
+using namespace std;
+
+// Codes of the ZS tag of one end. The order is the order of the tag strings,
+// so that tag pair codes sort as the "tag1,tag2" strings do.
+enum ZsCode {
+	ZS_PP=0, // ++
+	ZS_PM=1, // +-
+	ZS_MP=2, // -+
+	ZS_MM=3, // --
+	ZS_N=4 // mapping not found
+};
+#define NUMZSCODES 5
+
+// Tag pair of two ends in one byte: tag1*NUMZSCODES+tag2
+#define NUMTAGPAIRS 25
+#define TAGPAIR_NN (ZS_N*NUMZSCODES+ZS_N)
+// Fragment seen in secondary mappings only
+#define TAGPAIR_NONE 0xff
+
+typedef array< uint64_t, NUMTAGPAIRS > TagCounts; // tagpair->number
+
+static const char *zsnames[NUMZSCODES]={"++", "+-", "-+", "--", "N"};
+
+static inline uint8_t tagpair(uint8_t tag1, uint8_t tag2) {
+	return tag1*NUMZSCODES+tag2;
+}
+
+static inline uint8_t tagpair1(uint8_t pair) {
+	return pair/NUMZSCODES;
+}
+
+static inline uint8_t tagpair2(uint8_t pair) {
+	return pair%NUMZSCODES;
+}
+
+static inline string tagpairname(uint8_t pair) {
+	return string(zsnames[tagpair1(pair)])+","+zsnames[tagpair2(pair)];
+}
+
+// Parse a "tag1,tag2" string; return -1 if it is not a tag pair
+static inline int parsetagpair(const string &s) {
+	for (int pair=0; pair<NUMTAGPAIRS; pair++) {
+		if (tagpairname(pair)==s) return pair;
+	}
+	return -1;
+}
+
+// Six true PE mappings in traditional library preparation:
+//   (++,+-), (-+,--), (++,N), (N,+-), (-+,N), (N,--)
+static constexpr uint8_t validtags_trad[NUMTAGPAIRS]={
+	// tag2: ++ +- -+ -- N
+	0, 1, 0, 0, 1, // tag1: ++
+	0, 0, 0, 0, 0, // tag1: +-
+	0, 0, 0, 1, 1, // tag1: -+
+	0, 0, 0, 0, 0, // tag1: --
+	0, 1, 0, 1, 0 // tag1: N
+};
+// 12 true PE mappings in Pico library preparation:
+//   (++,+-), (+-,++), (-+,--), (--,-+), (++,N), (N,++),
+//   (+-,N), (N,+-), (-+,N), (N,-+), (--,N), (N,--)
+static constexpr uint8_t validtags_pico[NUMTAGPAIRS]={
+	// tag2: ++ +- -+ -- N
+	0, 1, 0, 0, 1, // tag1: ++
+	1, 0, 0, 0, 1, // tag1: +-
+	0, 0, 0, 1, 1, // tag1: -+
+	0, 0, 1, 0, 1, // tag1: --
+	1, 1, 1, 1, 0 // tag1: N
+};
+
+// Offset of the ZS field in the aux area of the last record decoded by the
+// thread. Aligners write the aux fields in the same order and mostly of the
+// same length, so the next record usually has it there too.
+static thread_local size_t zsoffset=0;
+
+// A ZS:Z field of two strands at p, before end
+static inline bool iszsfield(const uint8_t *p, const uint8_t *end) {
+	return end-p>=6 && p[0]=='Z' && p[1]=='S' && p[2]=='Z'
+		&& (p[3]=='+' || p[3]=='-') && (p[4]=='+' || p[4]=='-') && p[5]=='\0';
+}
+
+// Size of a value of a numeric aux type; 0 if it is not one
+static inline size_t auxtypesize(uint8_t type) {
+	switch (type) {
+		case 'A': case 'c': case 'C': return 1;
+		case 's': case 'S': return 2;
+		case 'i': case 'I': case 'f': return 4;
+		case 'd': return 8;
+	}
+	return 0;
+}
+
+// Size of the aux field at p, before end, from its type; 0 if it is malformed
+static inline size_t auxfieldsize(const uint8_t *p, const uint8_t *end) {
+	if (end-p<3) return 0;
+	size_t size=auxtypesize(p[2]);
+	if (p[2]=='Z' || p[2]=='H') {
+		const uint8_t *nul=(const uint8_t *)memchr(p+3, '\0', end-p-3);
+		if (nul==0) return 0;
+		size=nul-p-2;
+	} else if (p[2]=='B') {
+		int32_t n;
+		if (end-p<8 || auxtypesize(p[3])==0) return 0;
+		memcpy(&n, p+4, sizeof(n));
+		size=5+(size_t)(uint32_t)n*auxtypesize(p[3]);
+	}
+	if (size==0 || (size_t)(end-p)<3+size) return 0;
+	return 3+size;
+}
+
+// Decode the ZS tag of a mapping straight from the aux bytes. Instead of
+// comparing every tag as bam_aux_get() does, look at the offset of the last
+// record, then scan for the bytes of a ZS:Z field with memchr(). The same
+// bytes may be inside a string or an array, so a candidate only counts at a
+// field boundary: the fields before it are stepped over by their sizes, and
+// the scan resumes after the field it falls into. A missing or malformed ZS
+// tag is N.
+static inline uint8_t zscode(const bam1_t *b) {
+	const uint8_t *aux=bam1_aux(b);
+	const uint8_t *end=b->data+b->data_len;
+	const uint8_t *field=aux; // boundary of the fields stepped over
+	const uint8_t *p=zsoffset<(size_t)(end-aux) ? aux+zsoffset : aux;
+	while (true) {
+		while (field<p) {
+			size_t size=auxfieldsize(field, end);
+			if (size==0) return ZS_N;
+			field+=size;
+		}
+		if (field==p && iszsfield(p, end)) break;
+		const uint8_t *from=field==p ? p+1 : field;
+		if (from>=end || (p=(const uint8_t *)memchr(from, 'Z', end-from))==0) return ZS_N;
+	}
+	zsoffset=p-aux;
+	return (p[3]=='-')<<1 | (p[4]=='-');
+}
+
+// Set the tag of one end in a tag pair
+static inline uint8_t settagpair(uint8_t pair, uint32_t flag, uint8_t zs) {
+	if (pair==TAGPAIR_NONE) pair=TAGPAIR_NN;
+	if (flag & 0x40) {
+		return tagpair(zs, tagpair2(pair));
+	} else if (flag & 0x80) {
+		return tagpair(tagpair1(pair), zs);
+	}
+	return pair;
+}
+
+#endif
@@ -0,0 +1,160 @@
+#include <algorithm>
+#include "taskqueue.h"
+
+// Queue the tasks of the chromosomes to run: the first scans, largest first,
+// and the second scans, in window order, of the windows whose decisions are
+// known without first scans
+void TaskQueue::load(const vector< Task > &tasks) {
+	vector< Task > first;
+	vector< Task > second;
+	for (const Task &task : tasks) {
+		task.job->pending=task.job->windows.size();
+		(task.pass==1 ? first : second).push_back(task);
+	}
+	stable_sort(first.begin(), first.end(), [](const Task &a, const Task &b) {
+			return a.job->windows[a.window]->size>b.job->windows[b.window]->size;
+			});
+	lock_guard< mutex > lock(m);
+	this->first.assign(first.begin(), first.end());
+	started.clear();
+	this->second.assign(second.begin(), second.end());
+	firstpending=first.size();
+	inflight=0;
+	parked.clear();
+}
+
+void TaskQueue::setpipeline(int numworkers, int64_t budget, uint64_t perrecord) {
+	lock_guard< mutex > lock(m);
+	this->numworkers=max(1, numworkers);
+	this->budget=budget;
+	this->perrecord=perrecord;
+}
+
+// Estimated bytes of the dictionaries of a chromosome, or of one partition
+int64_t TaskQueue::cost(const ChrJob &job) const {
+	uint64_t records=0;
+	for (const unique_ptr< Window > &window : job.windows) {
+		records+=window->size;
+	}
+	return records*perrecord/job.partitions;
+}
+
+// Second scans are queued in window order
+void TaskQueue::push(const Task &task) {
+	lock_guard< mutex > lock(m);
+	second.push_back(task);
+	cv.notify_one();
+}
+
+// Hold a second scan until all first scans are finished, e.g. when it needs
+// tags from other chromosomes. The caller is a first scan not yet done.
+void TaskQueue::park(const Task &task) {
+	lock_guard< mutex > lock(m);
+	parked.push_back(task);
+}
+
+void TaskQueue::firstdone() {
+	lock_guard< mutex > lock(m);
+	if (--firstpending>0) return;
+	second.insert(second.begin(), parked.begin(), parked.end());
+	parked.clear();
+	cv.notify_all();
+}
+
+// The dictionaries of a reconciled chromosome are released
+void TaskQueue::release(const ChrJob &job) {
+	lock_guard< mutex > lock(m);
+	inflight-=cost(job);
+	cv.notify_all();
+}
+
+// Take the next task if one may run now. A new chromosome exceeding the
+// budget still starts when nothing else is in memory.
+bool TaskQueue::next(Task &task, const Window *cached) {
+	for (deque< Task >::iterator it=second.begin(); cached!=0 && it!=second.end(); ++it) {
+		if (it->job->windows[it->window].get()==cached) {
+			task=*it;
+			second.erase(it);
+			runningsecond++;
+			return true;
+		}
+	}
+	bool secondfirst=runningsecond<max(1, numworkers/2);
+	if (! second.empty() && (secondfirst || (started.empty() && first.empty()))) {
+		task=second.front();
+		second.pop_front();
+		runningsecond++;
+		return true;
+	}
+	if (! started.empty()) {
+		task=started.front();
+		started.pop_front();
+		return true;
+	}
+	if (! first.empty()) {
+		int64_t c=cost(*first.front().job);
+		if (budget==0 || inflight==0 || inflight+c<=budget) {
+			task=first.front();
+			first.pop_front();
+			inflight+=c;
+			if (task.job->windows.size()>1) {
+				// the other windows of the chromosome go first
+				for (deque< Task >::iterator it=first.begin(); it!=first.end(); ) {
+					if (it->job==task.job) {
+						started.push_back(*it);
+						it=first.erase(it);
+					} else {
+						++it;
+					}
+				}
+			}
+			return true;
+		}
+	}
+	if (! second.empty()) {
+		task=second.front();
+		second.pop_front();
+		runningsecond++;
+		return true;
+	}
+	return false;
+}
+
+bool TaskQueue::pop(Task &task, const Window *cached) {
+	unique_lock< mutex > lock(m);
+	bool got=false;
+	cv.wait(lock, [this, &task, &got, cached] { return (got=next(task, cached)) || running==0; });
+	if (! got) {
+		return false;
+	}
+	running++;
+	return true;
+}
+
+void TaskQueue::done(const Task &task) {
+	lock_guard< mutex > lock(m);
+	running--;
+	if (task.pass==2) {
+		runningsecond--;
+	}
+	cv.notify_all();
+}
+
+void TaskQueue::setspare(int spare, int share) {
+	lock_guard< mutex > lock(m);
+	this->spare=spare;
+	this->share=share;
+}
+
+int TaskQueue::borrow() {
+	lock_guard< mutex > lock(m);
+	int n=min(spare, share);
+	spare-=n;
+	return n;
+}
+
+// A worker leaving the drained queue lends its own thread too
+void TaskQueue::lend(int n) {
+	lock_guard< mutex > lock(m);
+	spare+=n;
+}
@@ -0,0 +1,85 @@
+#ifndef TASKQUEUE_H
+#define TASKQUEUE_H
+
+#include <deque>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include "chrjob.h"
+
+using namespace std;
+
+class Task {
+	public:
+		ChrJob *job;
+		int window;
+		int pass; // 1: build the tag dictionary; 2: filter
+	public:
+		Task(ChrJob *job=0, int window=0, int pass=1):
+			job(job)
+			, window(window)
+			, pass(pass) { }
+};
+
+// Shared queue of window tasks from which idle workers take the next task.
+// The first scans are queued largest first, so that no worker starts a big
+// window when the others are about to finish. A task may queue more tasks
+// before it is done; the queue is drained when no task is queued or running.
+// The queue also keeps the threads of the -t budget which are not filtering;
+// a second scan borrows some of them to compress its output.
+//
+// The first and second scans are pipelined: up to half of the workers take
+// the second scans of reconciled chromosomes, and the others go on with the
+// first scans of the next chromosomes, so that reading and compressing
+// overlap. The first window of a chromosome is only started while the
+// dictionaries in memory fit in the budget; the other windows of a started
+// chromosome go first, so that it is reconciled and released soon. A worker
+// takes the second scan of the window whose blocks it has cached first. The
+// windows of the files of a batch share the queue and the budget.
+class TaskQueue {
+	private:
+		deque< Task > first; // first scans of chromosomes not started
+		deque< Task > started; // first scans of started chromosomes
+		deque< Task > second; // second scans ready to run
+		int running;
+		int runningsecond; // second scans running
+		int numworkers;
+		int64_t budget; // bytes of dictionaries in memory, 0 is unlimited
+		uint64_t perrecord; // estimated bytes of dictionary per record
+		int64_t inflight; // bytes of the dictionaries of started chromosomes
+		int spare; // threads not filtering, lent to compression
+		int share; // most threads lent to one output
+		int firstpending; // first scans not finished
+		vector< Task > parked; // second scans waiting for all first scans
+		mutex m;
+		condition_variable cv;
+	private:
+		int64_t cost(const ChrJob &job) const;
+		bool next(Task &task, const Window *cached);
+	public:
+		TaskQueue():
+			running(0)
+			, runningsecond(0)
+			, numworkers(1)
+			, budget(0)
+			, perrecord(0)
+			, inflight(0)
+			, spare(0)
+			, share(0)
+			, firstpending(0) { }
+	public:
+		void load(const vector< Task > &tasks);
+		void setpipeline(int numworkers, int64_t budget, uint64_t perrecord);
+		void push(const Task &task);
+		void park(const Task &task);
+		void release(const ChrJob &job);
+		void firstdone();
+		bool pop(Task &task, const Window *cached);
+		void done(const Task &task);
+		void setspare(int spare, int share);
+		int borrow();
+		void lend(int n);
+};
+
+#endif
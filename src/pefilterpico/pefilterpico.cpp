@@ -4,6 +4,7 @@
 #include <map>
 #include <set>
 #include "sam.h"
+#include "tagcode.h"
 
 using namespace std;
 
@@ -14,11 +15,11 @@ using namespace std;
 map< string, vector< string > > read2tag;
 static int addtag(const bam1_t *b, void *data) {
 	string qname=string((char*)bam1_qname(b));
-	string zs=string((char *)bam_aux2Z(bam_aux_get(b, "ZS")));
 	uint32_t flag=b->core.flag;
 
 	// Skip the multiple mapping @ 20191125
 	if (flag & 0x100) return 1;
+	string zs=zsnames[zscode(b)];
 
 	map< string, vector< string > > :: iterator it=read2tag.find(qname);
 	if (read2tag.end()!=it) {
@@ -3,6 +3,7 @@
 #include <vector>
 #include <map>
 #include "sam.h"
+#include "tagcode.h"
 
 using namespace std;
 
@@ -14,7 +15,7 @@ map< string, vector< string > > read2tag;
 static int addtag(const bam1_t *b, void *data)
 {
 	string qname=string((char*)bam1_qname(b));
-	string zs=string( (char *) bam_aux2Z(bam_aux_get(b,"ZS")));
+	string zs=zsnames[zscode(b)];
 	uint32_t flag=b->core.flag;
 
 	map< string, vector< string > > :: iterator it = read2tag.find(qname);
@@ -0,0 +1,5 @@
+#!/usr/bin/env bash
+# vim: set noexpandtab tabstop=2:
+
+set -v
+../src/pefilter/pefilter -i LC1_chr_1k.bam -s -a 1 -t 4
@@ -0,0 +1,11 @@
+#!/usr/bin/env bash
+# vim: set noexpandtab tabstop=2:
+
+set -v
+tmpdir=$(mktemp -d)
+cp LC1_chr_1k.bam "$tmpdir/sample1.bam"
+cp LC1_chr_1k.bam.bai "$tmpdir/sample1.bam.bai"
+printf "LC1_chr_1k.bam $tmpdir/outfile.bam\n$tmpdir/sample1.bam $tmpdir/outfile1.bam\n" > "$tmpdir/samples.txt"
+../src/pefiltertag/pefiltertag -b "$tmpdir/samples.txt" -t 4 -m 1M
+../src/pefiltertag/pefiltertag -b "$tmpdir/samples.txt" -s -t 4
+tree "$tmpdir"
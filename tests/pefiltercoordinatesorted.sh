@@ -0,0 +1,7 @@
+#!/usr/bin/env bash
+# vim: set noexpandtab tabstop=2:
+
+set -v
+tmpdir=$(mktemp -d)
+../src/pefiltertag/pefiltertag -i LC1_chr_1k.bam -C -o "$tmpdir/outfile.bam"
+tree "$tmpdir"
@@ -0,0 +1,7 @@
+#!/usr/bin/env bash
+# vim: set noexpandtab tabstop=2:
+
+set -v
+tmpdir=$(mktemp -d)
+../src/pefilter/pefilter -i LC1_chr_1k.bam -o "$tmpdir/outfile.bam" -t 4 -m 1K
+tree "$tmpdir"
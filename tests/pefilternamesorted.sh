@@ -0,0 +1,8 @@
+#!/usr/bin/env bash
+# vim: set noexpandtab tabstop=2:
+
+set -v
+tmpdir=$(mktemp -d)
+../lib/samtools-0.1.20/samtools sort -n LC1_chr_1k.bam "$tmpdir/namesorted"
+../src/pefiltertag/pefiltertag -i "$tmpdir/namesorted.bam" -n -o "$tmpdir/outfile.bam"
+tree "$tmpdir"
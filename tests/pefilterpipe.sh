@@ -0,0 +1,9 @@
+#!/usr/bin/env bash
+# vim: set noexpandtab tabstop=2:
+
+set -v
+tmpdir=$(mktemp -d)
+../lib/samtools-0.1.20/samtools sort -n -o LC1_chr_1k.bam "$tmpdir/namesorted" \
+	| ../src/pefiltertag/pefiltertag -i - -o - -l 1 \
+	| ../lib/samtools-0.1.20/samtools sort - "$tmpdir/outfile"
+tree "$tmpdir"
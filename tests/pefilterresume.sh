@@ -0,0 +1,14 @@
+#!/usr/bin/env bash
+# vim: set noexpandtab tabstop=2:
+
+set -v
+tmpdir=$(mktemp -d)
+timeout -s KILL 0.2 ../src/pefilter/pefilter -i LC1_chr_1k.bam -o "$tmpdir/outfile.bam" -t 1 -l 9 --resume
+cat "$tmpdir/outfile.bam.manifest"
+../src/pefilter/pefilter -i LC1_chr_1k.bam -o "$tmpdir/outfile.bam" -t 4 --resume
+# a resume that can not write its manifest must fail
+if ../src/pefilter/pefilter -i LC1_chr_1k.bam -o "$tmpdir/missing/outfile.bam" -t 4 --resume; then
+	echo "Error: the failed resume exited 0"
+	exit 1
+fi
+tree "$tmpdir"
@@ -0,0 +1,10 @@
+#!/usr/bin/env bash
+# vim: set noexpandtab tabstop=2:
+
+set -v
+tmpdir=$(mktemp -d)
+cp LC1_chr_1k.bam LC1_chr_1k.bam.bai "$tmpdir"
+../src/pefiltertag/pefiltertag -i "$tmpdir/LC1_chr_1k.bam" -o "$tmpdir/outfile.bam" -t 4 --sidecar
+../src/pefiltertag/pefiltertag -i "$tmpdir/LC1_chr_1k.bam" -s --sidecar
+../src/pefiltertag/pefiltertag -i "$tmpdir/LC1_chr_1k.bam" -o "$tmpdir/outfile2.bam" -t 4 -d ++,+- -d -+,-- --sidecar
+tree "$tmpdir"
@@ -0,0 +1,12 @@
+#!/usr/bin/env bash
+# vim: set noexpandtab tabstop=2:
+
+set -v
+tmpdir=$(mktemp -d)
+# the bytes of a ZS:Z field also appear inside string and array tags
+../lib/samtools-0.1.20/samtools view -bS zsstring.sam > "$tmpdir/zsstring.bam"
+../lib/samtools-0.1.20/samtools index "$tmpdir/zsstring.bam"
+../src/pefilter/pefilter -i "$tmpdir/zsstring.bam" -o "$tmpdir/outfile.bam"
+# every fragment is a true PE mapping, so all records are kept
+test "$(../lib/samtools-0.1.20/samtools view -c "$tmpdir/outfile.bam")" = 8 || exit 1
+tree "$tmpdir"